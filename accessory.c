@@ -0,0 +1,600 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <string.h>
+#include "accessory.h"
+#include "i2c.h"
+#include "w2i.h"
+#include "timer.h"
+#include "stats.h"
+#include "trace.h"
+
+/* The wiibrew documentation talks about writing to 0x(4)a400xx, reading from 0x(4)a500xx.
+ *
+ * In binary:
+ * 0xa4..  1010 0100
+ * 0xa5..  1010 0101
+ *
+ * It is clear that A4 and A5 is the first 8 bits of the I2C transaction. The least
+ * significant bit is the I2C R/W bit.
+ *
+ * This translates to a 0x52 7bit address (0xa4>>1)
+ *
+ * Now the Wii motion plus documentation mentions 0x(4)A6000
+ * (http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Wii_Motion_Plus)
+ *
+ * So we have in binary:
+ * 0xa6..  1010 0110
+ *
+ * The wii motion plus I2C 7 bit address is therfore 0x53.
+ *
+ * The document then explains the wii motion plus can be made to answer at 0xa4
+ * by writing 0x04 to register 0xFE.
+ */
+
+#define I2C_STANDARD_ADDRESS	0x52
+#define I2C_W2I_MPLUS_ADDRESS	0x53
+
+#define STATE_INIT		0
+#define STATE_READ_DATA	1
+#define STATE_INIT_F0	2
+#define STATE_INIT_FB	3
+#define STATE_INIT_ID	4
+#define STATE_SETTLE	5
+#define STATE_INIT_CAL	6
+
+/* Delay between identification and the first report read */
+#define SETTLE_TIME		TIMER_MS(50)
+
+static char state = STATE_INIT;
+
+struct accessory_sample g_accessory;
+
+static unsigned short peripheral_id = ACCESSORY_NUNCHUK;
+
+static unsigned char report_buf[6];
+static unsigned char report_reg = W2I_REG_REPORT;
+
+static void reportReadDone(struct i2c_xfer *xfer);
+static void pointerWriteDone(struct i2c_xfer *xfer);
+
+/* Sets the register pointer back to 0x00 for the next report read. */
+static struct i2c_xfer pointer_xfer = {
+	addr:		I2C_STANDARD_ADDRESS,
+	wr_len:		1,
+	wr_data:	&report_reg,
+	complete:	pointerWriteDone,
+};
+
+static struct i2c_xfer report_xfer = {
+	addr:		I2C_STANDARD_ADDRESS,
+	wr_data:	&report_reg,
+	rd_len:		sizeof(report_buf),
+	rd_data:	report_buf,
+	complete:	reportReadDone,
+};
+
+/* The accessory needs some time between transactions (see
+ * w2i_turnaroundTicks). Completion callbacks note when the bus went
+ * idle, and startTransfers() submits what is due once that time has
+ * passed. */
+static volatile uint16_t xfer_end;
+static volatile char pointer_due = 0;
+static char read_due = 0;
+
+static void reportReadDone(struct i2c_xfer *xfer)
+{
+	xfer_end = timer_now();
+
+	/* Prepare the next read now so the report can be fetched
+	 * without any write at the next poll. */
+	if (xfer->status == 0 && !xfer->wr_len)
+		pointer_due = 1;
+}
+
+static void pointerWriteDone(struct i2c_xfer *xfer)
+{
+	xfer_end = timer_now();
+}
+
+static char report_pending = 0;
+static uint16_t read_since;
+#define BUSY_TIMEOUT	TIMER_MS(10)
+
+static char device_changed = 0;
+static unsigned char sample_seq;
+
+static uint16_t settle_start;
+
+static void startTransfers(void)
+{
+	if (!pointer_due && !read_due)
+		return;
+
+	// Nothing completes behind our back while the bus is idle
+	if (i2c_busy() || (uint16_t)(timer_now() - xfer_end) < w2i_turnaroundTicks())
+		return;
+
+	if (pointer_due) {
+		pointer_due = 0;
+		i2c_submit(&pointer_xfer);
+		return;
+	}
+
+	// Completion is handled by accessory_poll()
+	read_due = 0;
+	report_pending = 1;
+	i2c_submit(&report_xfer);
+}
+
+/* Factory calibration, converted at connection to a fixed point
+ * scale on each side of the center. An axis then takes a single
+ * multiply and shift per sample to cover its full range. */
+struct axis_cal {
+	unsigned short center; // raw units
+	unsigned short scale_lo, scale_hi; // 8.8
+};
+
+#define CAL_X		0 // Nunchuk stick, Classic left stick
+#define CAL_Y		1
+#define CAL_RX		2 // Classic right stick
+#define CAL_RY		3
+#define CAL_ACCEL	2 // Nunchuk accelerometer X, Y, Z
+#define CAL_AXES	5
+
+static struct axis_cal cal[CAL_AXES];
+
+/* Calibrated accelerometer units per g. About what most Nunchuks
+ * report, so settings in accelerometer units (mouse scrolling
+ * thresholds) keep their meaning. */
+#define ACCEL_1G	0xC0
+
+#define CAL_SIZE	16
+
+/* Map raw to 0 - max, with the center at mid */
+static unsigned short calibrate(unsigned short raw, const struct axis_cal *c, unsigned short mid, unsigned short max)
+{
+	unsigned short v;
+
+	if (raw >= c->center) {
+		v = mid + (((unsigned long)(raw - c->center) * c->scale_hi) >> 8);
+		return v > max ? max : v;
+	}
+
+	v = ((unsigned long)(c->center - raw) * c->scale_lo) >> 8;
+	return v > mid ? 0 : mid - v;
+}
+
+/* Rounded up, so the end of the range is reached (and clamped) */
+static unsigned short calScale(unsigned short out, unsigned short in)
+{
+	unsigned long scale = (((unsigned long)out << 8) + in - 1) / in;
+
+	return scale > 0xffff ? 0 : scale;
+}
+
+/* Stick axis going from min to max. Values outside of what the
+ * range can express leave the axis uncalibrated. */
+static void calStick(struct axis_cal *c, unsigned char min, unsigned char center, unsigned char max, unsigned short mid, unsigned short out_max)
+{
+	if (min < center && center < max) {
+		c->scale_lo = calScale(mid, center - min);
+		c->scale_hi = calScale(out_max - mid, max - center);
+		if (c->scale_lo && c->scale_hi) {
+			c->center = center;
+			return;
+		}
+	}
+
+	c->center = mid;
+	c->scale_lo = c->scale_hi = 0x100;
+}
+
+/* Accelerometer axis reading zero at 0g and one_g at 1g */
+static void calAccel(struct axis_cal *c, unsigned short zero, unsigned short one_g)
+{
+	if (one_g > zero) {
+		c->scale_lo = c->scale_hi = calScale(ACCEL_1G, one_g - zero);
+		if (c->scale_lo) {
+			c->center = zero;
+			return;
+		}
+	}
+
+	c->center = 0x200;
+	c->scale_lo = c->scale_hi = 0x100;
+}
+
+/* The two last bytes are the sum of the others plus 0x55 and 0xAA */
+static char calChecksumOk(const unsigned char *buf)
+{
+	unsigned char i, sum = 0x55;
+
+	for (i=0; i<CAL_SIZE-2; i++)
+		sum += buf[i];
+
+	return buf[CAL_SIZE-2] == sum && buf[CAL_SIZE-1] == (unsigned char)(sum + 0x55);
+}
+
+static void loadCalibration(void)
+{
+	unsigned char buf[CAL_SIZE];
+	unsigned char i;
+	char valid = 0;
+
+	if (peripheral_id == ACCESSORY_NUNCHUK || peripheral_id == ACCESSORY_CLASSIC) {
+		// 0x30 holds a copy, in case the first one is damaged
+		valid = !w2i_reg_readBlock(I2C_STANDARD_ADDRESS, W2I_REG_CALIBRATION, buf, CAL_SIZE) && calChecksumOk(buf);
+		if (!valid)
+			valid = !w2i_reg_readBlock(I2C_STANDARD_ADDRESS, W2I_REG_CALIBRATION2, buf, CAL_SIZE) && calChecksumOk(buf);
+
+		TRACE(TRACE_CALIBRATION, valid);
+	}
+
+	if (!valid) {
+		// Raw values (an impossible range gives the identity mapping)
+		memset(buf, 0, sizeof(buf));
+	}
+
+	if (peripheral_id == ACCESSORY_CLASSIC) {
+		//  0 - 5	Left stick X, Y (max, min, center), 8 bit
+		//  6 - 11	Right stick X, Y (max, min, center), 8 bit
+		//  12 - 13	Triggers (not used)
+		//  14 - 15	Checksum
+		calStick(&cal[CAL_X], buf[1]>>2, buf[2]>>2, buf[0]>>2, 0x20, 0x3f);
+		calStick(&cal[CAL_Y], buf[4]>>2, buf[5]>>2, buf[3]>>2, 0x20, 0x3f);
+		calStick(&cal[CAL_RX], buf[7]>>3, buf[8]>>3, buf[6]>>3, 0x10, 0x1f);
+		calStick(&cal[CAL_RY], buf[10]>>3, buf[11]>>3, buf[9]>>3, 0x10, 0x1f);
+		return;
+	}
+
+	//  0 - 2	Accelerometer X, Y, Z at 0g <9:2>
+	//  3		Low bits of the above (not used)
+	//  4 - 6	Accelerometer X, Y, Z at 1g <9:2>
+	//  7		Low bits of the above (not used)
+	//  8 - 13	Stick X, Y (max, min, center)
+	//  14 - 15	Checksum
+	for (i=0; i<3; i++) {
+		calAccel(&cal[CAL_ACCEL+i], buf[i]<<2, buf[4+i]<<2);
+	}
+	calStick(&cal[CAL_X], buf[9], buf[10], buf[8], 0x80, 0xff);
+	calStick(&cal[CAL_Y], buf[12], buf[13], buf[11], 0x80, 0xff);
+}
+
+/* Connection and identification. One step per call, so
+ * the main loop keeps running in between. */
+static void accessory_connectStep(void)
+{
+	unsigned char buf[2];
+	char res;
+
+	switch (state)
+	{
+		case STATE_INIT_F0:
+			//
+			// Init sequence from:
+			//
+			// http://wiibrew.org/wiki/Wiimote/Extension_Controllers
+			//
+			res = w2i_reg_writeByte(I2C_STANDARD_ADDRESS, W2I_REG_UNKNOWN_F0, 0x55);
+			state = res ? STATE_INIT : STATE_INIT_FB;
+			break;
+
+		case STATE_INIT_FB:
+			res = w2i_reg_writeByte(I2C_STANDARD_ADDRESS, W2I_REG_UNKNOWN_FB, 0x00);
+			state = res ? STATE_INIT : STATE_INIT_ID;
+			break;
+
+		case STATE_INIT_ID:
+			res = w2i_reg_readBlock(I2C_STANDARD_ADDRESS, W2I_REG_ID_L, buf, 2);
+			if (res) {
+				state = STATE_INIT;
+				break;
+			}
+
+			peripheral_id = buf[1] | buf[0]<<8;
+
+			w2i_probeTiming(I2C_STANDARD_ADDRESS, buf);
+
+			state = STATE_INIT_CAL;
+			break;
+
+		case STATE_INIT_CAL:
+			loadCalibration();
+
+			settle_start = timer_now();
+			state = STATE_SETTLE;
+			break;
+
+		case STATE_SETTLE:
+			if ((uint16_t)(timer_now() - settle_start) < SETTLE_TIME)
+				break;
+
+			state = STATE_READ_DATA;
+			device_changed = 1;
+
+			pointer_xfer.status = 0;
+			xfer_end = timer_now();
+			// With a combined read, the address is sent with each read.
+			report_xfer.wr_len = w2i_combinedRead();
+			pointer_due = !report_xfer.wr_len;
+			break;
+	}
+}
+
+void accessory_update(void)
+{
+	TRACE(TRACE_UPDATE, state);
+
+	switch (state)
+	{
+		case STATE_INIT:
+			// An accessory unplugged during a transfer may hold SDA low
+			if (i2c_recoverBus() < 0)
+				break;
+
+			w2i_resetTiming();
+
+			// For now, we consider everything answering at this address to be the motion plus.
+			// This switches the mplus to the standard address.
+			w2i_reg_writeByte(I2C_W2I_MPLUS_ADDRESS, 0xFE, 0x04);
+			// ignore failure
+
+			// The rest is done by accessory_connectStep()
+			state = STATE_INIT_F0;
+			break;
+
+		case STATE_READ_DATA:
+			if (pointer_xfer.status && pointer_xfer.status != I2C_XFER_PENDING) {
+				w2i_transferResult(pointer_xfer.status);
+				pointer_due = read_due = report_pending = 0;
+				state = STATE_INIT;
+				STATS_INC(reconnects);
+				return;
+			}
+
+			if (read_due || report_pending) {
+				// A report read takes around 1ms. Something is wrong.
+				if ((uint16_t)(timer_now() - read_since) > BUSY_TIMEOUT) {
+					if (i2c_busy())
+						i2c_abort();
+					w2i_transferResult(-1);
+					// The aborted read must not be taken for a new one
+					pointer_due = read_due = report_pending = 0;
+					state = STATE_INIT;
+					STATS_INC(reconnects);
+				}
+				return;
+			}
+
+			// Start reading once the accessory is ready
+			read_due = 1;
+			read_since = timer_now();
+			startTransfers();
+			break;
+	}
+}
+
+/* Button layouts. Each entry gives the report byte and bit
+ * of a button, its polarity and the ACC_BTN_* bit it sets. */
+struct button_bit {
+	unsigned char src;
+	unsigned short dst;
+};
+
+#define ACTIVE_LOW(byte, bit)	(((byte)<<3) | (bit))
+#define ACTIVE_HIGH(byte, bit)	(0x80 | ACTIVE_LOW(byte, bit))
+
+static const struct button_bit nunchuk_buttons[] PROGMEM = {
+	{ ACTIVE_LOW(5, 0), ACC_BTN_Z },
+	{ ACTIVE_LOW(5, 1), ACC_BTN_C },
+};
+
+static const struct button_bit classic_buttons[] PROGMEM = {
+	{ ACTIVE_LOW(4, 2), ACC_BTN_START },
+	{ ACTIVE_LOW(5, 5), ACC_BTN_Y },
+	{ ACTIVE_LOW(5, 3), ACC_BTN_X },
+	{ ACTIVE_LOW(5, 6), ACC_BTN_B },
+	{ ACTIVE_LOW(5, 4), ACC_BTN_A },
+	{ ACTIVE_LOW(4, 5), ACC_BTN_L },
+	{ ACTIVE_LOW(4, 1), ACC_BTN_R },
+	{ ACTIVE_LOW(5, 2), ACC_BTN_ZR },
+	{ ACTIVE_LOW(5, 0), ACC_BTN_UP },
+	{ ACTIVE_LOW(4, 6), ACC_BTN_DOWN },
+	{ ACTIVE_LOW(4, 7), ACC_BTN_RIGHT },
+	{ ACTIVE_LOW(5, 1), ACC_BTN_LEFT },
+	{ ACTIVE_LOW(5, 7), ACC_BTN_ZL },
+	{ ACTIVE_LOW(4, 4), ACC_BTN_SELECT },
+	{ ACTIVE_LOW(4, 3), ACC_BTN_HOME },
+};
+
+static const struct button_bit mplus_buttons[] PROGMEM = {
+	{ ACTIVE_LOW(3, 1), ACC_BTN_YAW_FAST },
+	{ ACTIVE_LOW(3, 0), ACC_BTN_PITCH_FAST },
+	{ ACTIVE_LOW(4, 1), ACC_BTN_ROLL_FAST },
+	{ ACTIVE_HIGH(4, 0), ACC_BTN_EXTENSION },
+};
+
+static unsigned short decodeButtons(const unsigned char *buf, const struct button_bit *tbl, unsigned char count)
+{
+	unsigned short buttons = 0;
+	unsigned char src, v;
+
+	while (count--) {
+		src = pgm_read_byte(&tbl->src);
+		v = buf[(src >> 3) & 0x07] >> (src & 0x07);
+		if (!(src & 0x80))
+			v = ~v;
+		if (v & 1)
+			buttons |= pgm_read_word(&tbl->dst);
+		tbl++;
+	}
+
+	return buttons;
+}
+
+#define DECODE_BUTTONS(buf, tbl)	decodeButtons(buf, tbl, sizeof(tbl) / sizeof(struct button_bit))
+
+unsigned char accessory_mapButtons(unsigned short buttons, const struct accessory_button_map *map, unsigned char count)
+{
+	unsigned char out = 0;
+
+	while (count--) {
+		if (buttons & pgm_read_word(&map->from))
+			out |= pgm_read_byte(&map->to);
+		map++;
+	}
+
+	return out;
+}
+
+static void decodeNunchuk(const unsigned char *buf, struct accessory_sample *s)
+{
+	// Source: http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Nunchuck
+	//
+	//     7   6    5   4    3   2     1   0
+	// 0   SX<7:0>
+	// 1   SY<7:0>
+	// 2   AX<9:2>
+	// 3   AY<9:2>
+	// 4   AZ<9:2>
+	// 5   AZ<1:0>  AY<1:0>  AX<1:0>   BC  BZ
+	//
+	s->lx = calibrate(buf[0], &cal[CAL_X], 0x80, 0xff);
+	s->ly = calibrate(buf[1], &cal[CAL_Y], 0x80, 0xff);
+	s->accel[0] = calibrate(((buf[5] & 0x0C) >> 2)	| (buf[2] << 2), &cal[CAL_ACCEL+0], 0x200, 0x3ff);
+	s->accel[1] = calibrate(((buf[5] & 0x30) >> 4)	| (buf[3] << 2), &cal[CAL_ACCEL+1], 0x200, 0x3ff);
+	s->accel[2] = calibrate(((buf[5] & 0xC0) >> 6)	| (buf[4] << 2), &cal[CAL_ACCEL+2], 0x200, 0x3ff);
+
+	s->buttons = DECODE_BUTTONS(buf, nunchuk_buttons);
+}
+
+static void decodeClassic(const unsigned char *buf, struct accessory_sample *s)
+{
+	// Source: http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Classic_Controller
+	//
+	//     7        6     5    4    3     2     1     0
+	// 0   RX<4:3>        LX<5:0>
+	// 1   RX<2:1>        LY<5:0>
+	// 2   RX<0>    LT<4:3>    RY<4:0>
+	// 3   LT<2:0>             RT<4:0>
+	// 4   BDR      BDD   BLT  B-   BH    B+    BRT   1
+	// 5   BZL      BB    BY   BA   BX    BZR   BDL   BDU
+	//
+	s->lx = calibrate(buf[0] & 0x3f, &cal[CAL_X], 0x20, 0x3f);
+	s->ly = calibrate(buf[1] & 0x3f, &cal[CAL_Y], 0x20, 0x3f);
+	s->rx = calibrate((buf[2]>>7) | ((buf[1]&0xC0)>>5) | ((buf[0]&0xC0)>>3), &cal[CAL_RX], 0x10, 0x1f);
+	s->ry = calibrate(buf[2] & 0x1f, &cal[CAL_RY], 0x10, 0x1f);
+	s->lt = (buf[3]>>5) | ((buf[2] & 0x60) >> 2);
+	s->rt = buf[3] & 0x1f;
+
+	s->buttons = DECODE_BUTTONS(buf, classic_buttons);
+}
+
+static void decodeMotionPlus(const unsigned char *buf, struct accessory_sample *s)
+{
+	// Source: http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Wii_Motion_Plus
+	//
+	//     7   6   5   4   3   2   1       0
+	// 0   Yaw<7:0>
+	// 1   Roll<7:0>
+	// 2   Pitch<7:0>
+	// 3   Yaw<13:8>               Yslow   Pslow
+	// 4   Roll<13:8>              Rslow   Ext
+	// 5   Pitch<13:8>             1       0
+	//
+	s->gyro[ACC_GYRO_YAW] = buf[0] | ((buf[3]&0xFC)<<6);
+	s->gyro[ACC_GYRO_ROLL] = buf[1] | ((buf[4]&0xFC)<<6);
+	s->gyro[ACC_GYRO_PITCH] = buf[2] | ((buf[5]&0xFC)<<6);
+
+	s->buttons = DECODE_BUTTONS(buf, mplus_buttons);
+}
+
+char accessory_poll(void)
+{
+	struct accessory_sample *s = &g_accessory;
+
+	if (state != STATE_READ_DATA) {
+		accessory_connectStep();
+		return 0;
+	}
+
+	startTransfers();
+
+	if (!report_pending || report_xfer.status == I2C_XFER_PENDING)
+		return 0;
+
+	report_pending = 0;
+
+	w2i_transferResult(report_xfer.status);
+	if (report_xfer.status) {
+		state = STATE_INIT;
+		STATS_INC(reconnects);
+		return 0;
+	}
+
+	// Fields the accessory does not have read as 0
+	memset(s, 0, sizeof(struct accessory_sample));
+	s->id = peripheral_id;
+	s->seq = ++sample_seq;
+	s->new_device = device_changed;
+	device_changed = 0;
+
+	switch (peripheral_id)
+	{
+		default:
+		case ACCESSORY_NUNCHUK:
+			decodeNunchuk(report_buf, s);
+			break;
+
+		case ACCESSORY_CLASSIC:
+			decodeClassic(report_buf, s);
+			break;
+
+		case ACCESSORY_MPLUS:
+			decodeMotionPlus(report_buf, s);
+			break;
+	}
+
+	return 1;
+}
+
+void accessory_init(void)
+{
+	//
+	// TWPS = 0
+	// CPU FREQ = 12000000
+	// TARGET SCL FREQ = 400000
+	//
+	//                   CPU FREQ
+	//             --------------------
+	// SCL freq =  16 + 2*TWBR * 4^TWPS
+	//
+	// TWBR = (((12000000 / 400000) - 16) / 1) / 2 = 7
+	//
+	//i2c_init(I2C_FLAG_EXTERNAL_PULLUP, 15);
+
+	// 100khz is always stable. Faster rates are probed
+	// for each accessory (see w2i_probeTiming)
+	i2c_init(I2C_FLAG_EXTERNAL_PULLUP, 52);
+
+	accessory_update();
+}
@@ -0,0 +1,105 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _accessory_h__
+#define _accessory_h__
+
+/* Wiimote accessory driver: connection, identification and decoding,
+ * shared by the joystick and mouse modes. */
+
+// Based on reading 0xFE and 0xFF. This might be wrong...
+#define ACCESSORY_NUNCHUK	0x0000
+#define ACCESSORY_CLASSIC	0x0101
+#define ACCESSORY_MPLUS		0x0405
+
+/* Buttons. The Classic controller bits follow the assignments
+ * of my Gamecube to USB adapter project. */
+#define ACC_BTN_Z			0x0001 // Nunchuk
+#define ACC_BTN_C			0x0002
+
+#define ACC_BTN_START		0x0001 // Classic controller (+)
+#define ACC_BTN_Y			0x0002
+#define ACC_BTN_X			0x0004
+#define ACC_BTN_B			0x0008
+#define ACC_BTN_A			0x0010
+#define ACC_BTN_L			0x0020
+#define ACC_BTN_R			0x0040
+#define ACC_BTN_ZR			0x0080
+#define ACC_BTN_UP			0x0100
+#define ACC_BTN_DOWN		0x0200
+#define ACC_BTN_RIGHT		0x0400
+#define ACC_BTN_LEFT		0x0800
+#define ACC_BTN_ZL			0x1000
+#define ACC_BTN_SELECT		0x2000 // -
+#define ACC_BTN_HOME		0x4000
+
+#define ACC_BTN_YAW_FAST	0x0001 // Motion Plus (not in slow mode)
+#define ACC_BTN_PITCH_FAST	0x0002
+#define ACC_BTN_ROLL_FAST	0x0004
+#define ACC_BTN_EXTENSION	0x0008 // Extension connected to the Motion Plus
+
+/* One decoded report, at the native resolution of the accessory.
+ * Sticks and the accelerometer are corrected using the factory
+ * calibration when it is valid. Conversion to report units is
+ * left to the active mode. */
+struct accessory_sample {
+	unsigned short id; // ACCESSORY_*
+	unsigned char seq; // Incremented for each new sample
+	char new_device; // First sample since the accessory was connected
+
+	/* Left stick. Nunchuk: 8 bit, Classic: 6 bit. Up is the maximum. */
+	unsigned char lx, ly;
+	/* Classic right stick, 5 bit. Up is the maximum. */
+	unsigned char rx, ry;
+	/* Classic analog triggers, 5 bit. Released is 0. */
+	unsigned char lt, rt;
+
+	/* Nunchuk accelerometer, 10 bit: X, Y, Z */
+	unsigned short accel[3];
+	/* Motion Plus rotation rates, 14 bit: yaw, roll, pitch */
+	unsigned short gyro[3];
+
+	unsigned short buttons; // ACC_BTN_*
+};
+
+#define ACC_GYRO_YAW	0
+#define ACC_GYRO_ROLL	1
+#define ACC_GYRO_PITCH	2
+
+/* Mode specific button assignments, in PROGMEM. Each entry
+ * sets the 'to' bits when any of the 'from' buttons is down. */
+struct accessory_button_map {
+	unsigned short from; // ACC_BTN_*
+	unsigned char to;
+};
+
+unsigned char accessory_mapButtons(unsigned short buttons, const struct accessory_button_map *map, unsigned char count);
+#define ACCESSORY_MAP_BUTTONS(buttons, map)	accessory_mapButtons(buttons, map, sizeof(map) / sizeof(struct accessory_button_map))
+
+/* The last sample read */
+extern struct accessory_sample g_accessory;
+
+void accessory_init(void);
+/* Start reading a sample (or a connection attempt) */
+void accessory_update(void);
+/* Call at each main loop iteration. Returns non-zero when
+ * g_accessory was updated. */
+char accessory_poll(void);
+
+#endif // _accessory_h__
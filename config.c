@@ -18,13 +18,20 @@
  * The author may be contacted at raph@raphnet.net
  */
 #include <string.h>
+#include <stddef.h>
 #include "eeprom.h"
 #include "usbdrv.h"
+#include "timer.h"
 
 #include "wusbmote_requests.h"
+#include "stats.h"
+#include "trace.h"
 
 struct eeprom_data_struct g_eeprom_data;
 
+static char profile_changed;
+static uint8_t running_mode;
+
 int usbDescriptorStringSerialNumber[]  = {
  	USB_STRING_DESCRIPTOR_HEADER(4),
 	'2','0','0','0'
@@ -36,6 +43,7 @@ int usbDescriptorStringSerialNumber[]  = {
 void eeprom_app_write_defaults(void)
 {
 	const char *default_serial = "1001";
+	int i;
 
 	memcpy(g_eeprom_data.cfg.serial, default_serial, 4);
 	g_eeprom_data.cfg.mode = CFG_MODE_JOYSTICK;
@@ -47,6 +55,13 @@ void eeprom_app_write_defaults(void)
 	g_eeprom_data.cfg.scroll_nunchuck_invert = 0;
 	g_eeprom_data.cfg.scroll_nunchuck_c = 1;
 	g_eeprom_data.cfg.scroll_nunchuck_c_threshold = 64;
+	g_eeprom_data.cfg.poll_rate = CFG_POLL_RATE_60HZ;
+	g_eeprom_data.cfg.low_latency = 0;
+	g_eeprom_data.cfg.sync_host = 0;
+
+	for (i=0; i<CFG_PROFILES; i++) {
+		memcpy(&g_eeprom_data.cfg.profiles[i], &g_eeprom_data.cfg.mode, sizeof(struct cfg_profile));
+	}
 }
 
 /* Called by the eeprom driver once the content
@@ -56,6 +71,8 @@ void eeprom_app_ready(void)
 {
 	int i;
 
+	running_mode = g_eeprom_data.cfg.mode;
+
 	// Update the dynamic string descriptor.
 	for (i=0; i<4; i++) {
 		usbDescriptorStringSerialNumber[i+1] = g_eeprom_data.cfg.serial[i];
@@ -65,7 +82,163 @@ void eeprom_app_ready(void)
 static void config_set_serial(char serial[4])
 {
 	memcpy(g_eeprom_data.cfg.serial, serial, 4);
-	eeprom_commit();
+	eeprom_commitLater();
+}
+
+/**** Profiles ****/
+
+typedef char cfg_fits_in_report[2 + sizeof(struct eeprom_cfg) <= CONFIG_REPORT_SIZE ? 1 : -1];
+typedef char cfg_profile_layout[offsetof(struct eeprom_cfg, scroll_nunchuck_c_threshold) -
+				offsetof(struct eeprom_cfg, mode) + 1 == sizeof(struct cfg_profile) ? 1 : -1];
+
+/* The active profile lives in the main fields */
+static struct cfg_profile *profilePtr(unsigned char index)
+{
+	if (index == g_eeprom_data.cfg.profile)
+		return (struct cfg_profile *)&g_eeprom_data.cfg.mode;
+
+	return &g_eeprom_data.cfg.profiles[index];
+}
+
+static char config_selectProfile(unsigned char index)
+{
+	struct eeprom_cfg *cfg = &g_eeprom_data.cfg;
+
+	if (index >= CFG_PROFILES)
+		return 0;
+
+	if (index != cfg->profile) {
+		memcpy(&cfg->profiles[cfg->profile], &cfg->mode, sizeof(struct cfg_profile));
+		memcpy(&cfg->mode, &cfg->profiles[index], sizeof(struct cfg_profile));
+		cfg->profile = index;
+	}
+	profile_changed = 1;
+
+	return 1;
+}
+
+static char config_copyProfile(unsigned char src, unsigned char dst)
+{
+	if (src >= CFG_PROFILES || dst >= CFG_PROFILES)
+		return 0;
+
+	memcpy(profilePtr(dst), profilePtr(src), sizeof(struct cfg_profile));
+	if (dst == g_eeprom_data.cfg.profile) {
+		profile_changed = 1;
+	}
+
+	return 1;
+}
+
+/* RQ_WUSBMOTE_SET_MODE alone still waits for the next
+ * power up, as it always did. */
+char config_mustRestart(void)
+{
+	return profile_changed && g_eeprom_data.cfg.mode != running_mode;
+}
+
+#define CHORD_HOLD_COUNT	20 // in 100ms units
+
+void config_profileChord(char held)
+{
+	static unsigned char count;
+	static uint16_t last;
+
+	if (!held) {
+		count = 0;
+		return;
+	}
+
+	if (!count) {
+		count = 1;
+		last = timer_now();
+	} else if ((uint16_t)(timer_now() - last) >= TIMER_MS(100)) {
+		last += TIMER_MS(100);
+		if (count < CHORD_HOLD_COUNT) {
+			count++;
+		} else if (count == CHORD_HOLD_COUNT) {
+			// Once per press
+			count++;
+			config_selectProfile((g_eeprom_data.cfg.profile + 1) % CFG_PROFILES);
+			eeprom_commitLater();
+		}
+	}
+}
+
+/**** Whole configuration transfers ****/
+
+static char isValid(const struct cfg_profile *p)
+{
+	return p->mode <= CFG_MODE_I2C_RAW && p->mouse_divisor;
+}
+
+static unsigned char config_setBlock(const unsigned char *data, unsigned char len)
+{
+	struct eeprom_cfg cfg;
+	unsigned char size = data[0];
+	int i;
+
+	if (size > len - 1)
+		return 0;
+	if (size > sizeof(cfg))
+		size = sizeof(cfg);
+
+	memcpy(&cfg, &g_eeprom_data.cfg, sizeof(cfg));
+	memcpy(&cfg, data + 1, size);
+
+	if (!isValid((struct cfg_profile *)&cfg.mode))
+		return 0;
+	if (cfg.poll_rate > CFG_POLL_RATE_1000HZ || cfg.profile >= CFG_PROFILES)
+		return 0;
+	for (i=0; i<CFG_PROFILES; i++) {
+		if (i != cfg.profile && !isValid(&cfg.profiles[i]))
+			return 0;
+	}
+
+	// On/off, as RQ_WUSBMOTE_SET_LOW_LATENCY and SET_SYNC_HOST store them
+	cfg.low_latency = cfg.low_latency ? 1 : 0;
+	cfg.sync_host = cfg.sync_host ? 1 : 0;
+
+	if (cfg.profile != g_eeprom_data.cfg.profile) {
+		profile_changed = 1;
+	}
+	memcpy(&g_eeprom_data.cfg, &cfg, sizeof(cfg));
+
+	return 1;
+}
+
+unsigned char config_handleReport(unsigned char *buf, unsigned char len)
+{
+	unsigned char dst[8];
+	unsigned char n;
+
+	switch (buf[0])
+	{
+		case RQ_WUSBMOTE_GET_CONFIG:
+			memset(buf + 1, 0, CONFIG_REPORT_SIZE - 1);
+			buf[1] = sizeof(struct eeprom_cfg);
+			memcpy(buf + 2, &g_eeprom_data.cfg, sizeof(struct eeprom_cfg));
+			return 2 + sizeof(struct eeprom_cfg);
+
+		case RQ_WUSBMOTE_SET_CONFIG:
+			if (len < 2 || !config_setBlock(buf + 1, len - 1))
+				return 0;
+			eeprom_commitLater();
+			memset(buf + 1, 0, CONFIG_REPORT_SIZE - 1);
+			return 1;
+	}
+
+	if (len < 5)
+		return 0;
+
+	n = config_handleCommand(buf[0], buf + 1, dst);
+	if (!n)
+		return 0;
+
+	memset(buf, 0, CONFIG_REPORT_SIZE);
+	memcpy(buf, dst, n);
+
+	return n;
 }
 
 /* Return 0 for unknown commands.
@@ -78,6 +251,44 @@ unsigned char config_handleCommand(unsigned char cmd, const unsigned char rqdata
 	{
 		case RQ_WUSBMOTE_SETSERIAL:
 			config_set_serial((char*)rqdata);
+			dst[0] = cmd;
+			return 1;
+		case RQ_WUSBMOTE_GET_STATS:
+			if (!stats_get(rqdata[0], dst + 1))
+				return 0;
+			dst[0] = cmd;
+			return 5;
+		case RQ_WUSBMOTE_GET_LOOP_HIST:
+			if (!stats_getLoopHist(rqdata[0], dst + 1))
+				return 0;
+			dst[0] = cmd;
+			return 5;
+#ifdef WITH_TRACE
+		case RQ_WUSBMOTE_GET_TRACE:
+			if (!trace_get(rqdata[0], dst + 1))
+				return 0;
+			dst[0] = cmd;
+			return 5;
+		case RQ_WUSBMOTE_TRACE_RESUME:
+			trace_resume();
+			dst[0] = cmd;
+			return 1;
+#endif
+		case RQ_WUSBMOTE_SELECT_PROFILE:
+			if (!config_selectProfile(rqdata[0]))
+				return 0;
+			break;
+		case RQ_WUSBMOTE_COPY_PROFILE:
+			if (!config_copyProfile(rqdata[0], rqdata[1]))
+				return 0;
+			break;
+		case RQ_WUSBMOTE_COMMIT:
+			eeprom_flush();
+			dst[0] = cmd;
+			return 1;
+		case RQ_WUSBMOTE_RESET_STATS:
+			stats_reset();
+			dst[0] = cmd;
 			return 1;
 		case RQ_WUSBMOTE_SET_MODE:
 			g_eeprom_data.cfg.mode = rqdata[0];
@@ -106,6 +317,17 @@ unsigned char config_handleCommand(unsigned char cmd, const unsigned char rqdata
 		case RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C_THRESHOLD:
 			g_eeprom_data.cfg.scroll_nunchuck_c_threshold = rqdata[0];
 			break;
+		case RQ_WUSBMOTE_SET_POLL_RATE:
+			if (rqdata[0] > CFG_POLL_RATE_1000HZ)
+				return 0;
+			g_eeprom_data.cfg.poll_rate = rqdata[0];
+			break;
+		case RQ_WUSBMOTE_SET_LOW_LATENCY:
+			g_eeprom_data.cfg.low_latency = rqdata[0] ? 1 : 0;
+			break;
+		case RQ_WUSBMOTE_SET_SYNC_HOST:
+			g_eeprom_data.cfg.sync_host = rqdata[0] ? 1 : 0;
+			break;
 
 		default:
 			return 0;
@@ -113,7 +335,8 @@ unsigned char config_handleCommand(unsigned char cmd, const unsigned char rqdata
 
 	/* acknowledge command by replying with at least the command ID. */
 	dst[0] = cmd;
-	eeprom_commit();
+	/* Written from the main loop, after the last of a series of commands */
+	eeprom_commitLater();
 	return 1;
 }
 
@@ -1,9 +1,22 @@
 #ifndef _config_h__
 #define _config_h__
 
-#define CFG_MODE_JOYSTICK	0x00
-#define CFG_MODE_MOUSE		0x01
-#define CFG_MODE_I2C_RAW	0x02
+#include <stdint.h>
+#include "wusbmote_requests.h" // CFG_MODE_*, CFG_PROFILES
+
+/* Settings that change with the active profile. Same layout
+ * as struct eeprom_cfg from mode to scroll_nunchuck_c_threshold. */
+struct cfg_profile {
+	uint8_t mode;
+	uint8_t mouse_divisor;
+	uint8_t mouse_deadzone;
+	uint8_t scroll_joystick_invert;
+	uint8_t scroll_nunchuck_invert;
+	uint8_t scroll_nunchuck_threshold;
+	uint8_t scroll_nunchuck_step;
+	uint8_t scroll_nunchuck_c;
+	uint8_t scroll_nunchuck_c_threshold;
+};
 
 struct eeprom_cfg {
 	uint8_t serial[4];
@@ -20,6 +33,21 @@ struct eeprom_cfg {
 	/* Scrolling by pressing C while moving */
 	uint8_t scroll_nunchuck_c; // on/off
 	uint8_t scroll_nunchuck_c_threshold;
+
+	/* Accessory sampling rate (CFG_POLL_RATE_*) */
+	uint8_t poll_rate;
+
+	/* Advertise a 1ms interrupt endpoint interval (takes
+	 * effect at next enumeration) */
+	uint8_t low_latency;
+
+	/* Time accessory reads to complete just before the host polls */
+	uint8_t sync_host;
+
+	/* Active profile. Its settings are the fields above (mode to
+	 * scroll_nunchuck_c_threshold). The others are stored here. */
+	uint8_t profile;
+	struct cfg_profile profiles[CFG_PROFILES];
 };
 
 void eeprom_app_write_defaults(void);
@@ -27,4 +55,16 @@ void eeprom_app_ready(void);
 
 unsigned char config_handleCommand(unsigned char cmd, const unsigned char rqdata[4], unsigned char dst[8]);
 
+/* Handle a configuration interface feature report. The reply
+ * replaces it in buf (CONFIG_REPORT_SIZE bytes). Returns 0 on error. */
+unsigned char config_handleReport(unsigned char *buf, unsigned char len);
+
+/* Call with each sample, telling if the profile switching button
+ * combination is held. Switches to the next profile after 2 seconds. */
+void config_profileChord(char held);
+
+/* True when a profile using another mode than the one running was
+ * selected. The device must restart and enumerate again. */
+char config_mustRestart(void);
+
 #endif
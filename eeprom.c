@@ -20,53 +20,281 @@
 
 #include <avr/eeprom.h>
 #include <util/crc16.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include "eeprom.h"
+#include "stats.h"
+#include "timer.h"
 
-static uint16_t calc_geeprom_data_crc(void)
+/* Deferred commits wait for this long without changes */
+#define EEPROM_QUIET_TIME	TIMER_MS(500)
+
+/* The EEPROM is divided in slots, each holding a record: A sequence
+ * number, the length of the content and the content itself (struct
+ * eeprom_data_struct without its CRC), followed by the CRC. Commits go
+ * to the slot following the current one, so wear is spread over all
+ * slots. The CRC covers the header, and is written last. An interrupted
+ * write therefore leaves an invalid record, and the previous one is used.
+ *
+ * Slots have a fixed size so struct eeprom_cfg can grow without
+ * moving them. */
+#define EEPROM_SLOT_SIZE	64
+#define EEPROM_SLOTS		((E2END + 1) / EEPROM_SLOT_SIZE)
+#define EEPROM_HEADER_SIZE	3
+#define EEPROM_RECORD_SIZE	(EEPROM_HEADER_SIZE + EEPROM_USED_SIZE)
+
+/* Before slots, the content was at address 0 without a header. Its
+ * struct eeprom_cfg ended with scroll_nunchuck_c_threshold. */
+#define EEPROM_LEGACY_SIZE_NOCRC	offsetof(struct eeprom_data_struct, cfg.poll_rate)
+
+#define slot_ptr(slot)		((uint8_t*)EEPROM_BASE_PTR + (slot) * EEPROM_SLOT_SIZE)
+
+typedef char record_fits_in_slot[EEPROM_RECORD_SIZE <= EEPROM_SLOT_SIZE ? 1 : -1];
+typedef char slots_fit_in_mask[EEPROM_SLOTS <= 16 ? 1 : -1];
+
+static uint16_t cur_seq;
+static unsigned char cur_slot;
+
+static char dirty, flush, writing;
+static uint16_t changed_at;
+static unsigned char write_pos;
+
+static uint16_t crc_block(uint16_t crc, const uint8_t *data, int len)
 {
-	uint16_t crc = 0x0000;
 	int i;
 
-	/* Update the CRC */
-	for (i=0; i<EEPROM_USED_SIZE_NOCRC; i++) {
-		crc = _crc_xmodem_update(crc, ((uint8_t*)&g_eeprom_data)[i]);
+	for (i=0; i<len; i++) {
+		crc = _crc_xmodem_update(crc, data[i]);
 	}
 
 	return crc;
 }
 
+/* CRC of a record holding len bytes of g_eeprom_data */
+static uint16_t calc_crc(uint16_t seq, uint8_t len)
+{
+	uint16_t crc;
+
+	crc = crc_block(0x0000, (uint8_t*)&seq, 2);
+	crc = _crc_xmodem_update(crc, len);
+
+	return crc_block(crc, (uint8_t*)&g_eeprom_data, len);
+}
+
+static uint16_t calc_geeprom_data_crc(uint16_t seq)
+{
+	return calc_crc(seq, EEPROM_USED_SIZE_NOCRC);
+}
+
+/* True if the len bytes of g_eeprom_data are followed by their CRC */
+static char crc_matches(uint16_t crc, uint8_t len)
+{
+	uint8_t *raw = (uint8_t*)&g_eeprom_data;
+
+	return crc == (raw[len] | (raw[len+1]<<8));
+}
+
+/* Byte pos of the record being written */
+static uint8_t record_byte(uint16_t seq, unsigned char pos)
+{
+	if (pos < 2)
+		return pos ? seq >> 8 : seq;
+	if (pos == 2)
+		return EEPROM_USED_SIZE_NOCRC;
+
+	return ((uint8_t*)&g_eeprom_data)[pos - EEPROM_HEADER_SIZE];
+}
+
 void eeprom_commit(void)
 {
-	g_eeprom_data.crc16 = calc_geeprom_data_crc();
+	unsigned char tag = stats_loopMark(LOOP_TAG_EEPROM);
+	unsigned char slot = (cur_slot + 1) % EEPROM_SLOTS;
+	uint16_t seq = cur_seq + 1;
+
+	g_eeprom_data.crc16 = calc_geeprom_data_crc(seq);
 
 	/* Sync eeprom content */
-	eeprom_update_block(&g_eeprom_data, EEPROM_BASE_PTR, EEPROM_USED_SIZE);
+	eeprom_update_block(&seq, slot_ptr(slot), 2);
+	eeprom_update_byte(slot_ptr(slot) + 2, EEPROM_USED_SIZE_NOCRC);
+	eeprom_update_block(&g_eeprom_data, slot_ptr(slot) + EEPROM_HEADER_SIZE, EEPROM_USED_SIZE);
+	cur_slot = slot;
+	cur_seq = seq;
+	dirty = writing = 0;
+
+	stats_loopMark(tag);
+}
+
+void eeprom_commitLater(void)
+{
+	dirty = 1;
+	changed_at = timer_now();
+
+	/* The CRC of a write in progress is no longer right. Start over. */
+	writing = 0;
 }
 
-static char isCrcValid()
+void eeprom_flush(void)
 {
-	return g_eeprom_data.crc16 == calc_geeprom_data_crc();
+	flush = 1;
+}
+
+void eeprom_poll(void)
+{
+	unsigned char slot = (cur_slot + 1) % EEPROM_SLOTS;
+	uint16_t seq = cur_seq + 1;
+	uint8_t b;
+
+	if (dirty) {
+		if (!flush && (uint16_t)(timer_now() - changed_at) < EEPROM_QUIET_TIME)
+			return;
+
+		g_eeprom_data.crc16 = calc_geeprom_data_crc(seq);
+		dirty = flush = 0;
+		write_pos = 0;
+		writing = 1;
+	}
+
+	if (!writing)
+		return;
+
+	/* A byte write takes about 3.4ms. Start one and come back
+	 * later. Unchanged bytes are skipped, like eeprom_update_block. */
+	while (write_pos < EEPROM_RECORD_SIZE) {
+		if (!eeprom_is_ready())
+			return;
+
+		b = record_byte(seq, write_pos);
+		if (eeprom_read_byte(slot_ptr(slot) + write_pos) != b) {
+			eeprom_write_byte(slot_ptr(slot) + write_pos, b);
+			write_pos++;
+			return;
+		}
+		write_pos++;
+	}
+
+	cur_slot = slot;
+	cur_seq = seq;
+	writing = 0;
+}
+
+/* Fields are only ever appended to struct eeprom_cfg. A record written
+ * by an older firmware holds a shorter content, and its header tells how
+ * long. Its settings are kept on firmware updates.
+ *
+ * Returns the length of the content (without CRC), which is
+ * EEPROM_USED_SIZE_NOCRC for the current layout, or 0 if invalid. */
+static int readRecord(unsigned char slot, uint16_t *seq)
+{
+	uint8_t len;
+
+	eeprom_read_block(seq, slot_ptr(slot), 2);
+	len = eeprom_read_byte(slot_ptr(slot) + 2);
+	if (len <= sizeof(g_eeprom_data.magic) || len > EEPROM_USED_SIZE_NOCRC)
+		return 0;
+
+	eeprom_read_block(&g_eeprom_data, slot_ptr(slot) + EEPROM_HEADER_SIZE, len + 2);
+	if (!crc_matches(calc_crc(*seq, len), len))
+		return 0;
+
+	return len;
+}
+
+/* Load the newest valid record. Returns the length of its
+ * content (without CRC) or 0 if none was found. */
+static int loadNewest(void)
+{
+	uint16_t seqs[EEPROM_SLOTS];
+	uint16_t magic, seq;
+	uint16_t tried = 0; // slots not worth (re)reading
+	unsigned char slot, best, i;
+	int len;
+
+	// Only the headers are read to find candidates.
+	for (slot=0; slot<EEPROM_SLOTS; slot++) {
+		eeprom_read_block(&seqs[slot], slot_ptr(slot), 2);
+		eeprom_read_block(&magic, slot_ptr(slot) + EEPROM_HEADER_SIZE, 2);
+		if (magic != EEPROM_MAGIC)
+			tried |= 1 << slot;
+	}
+
+	// Check candidates, newest first
+	for (i=0; i<EEPROM_SLOTS; i++) {
+		best = 0xff;
+		for (slot=0; slot<EEPROM_SLOTS; slot++) {
+			if (tried & (1 << slot))
+				continue;
+			// Sequence numbers wrap around
+			if (best == 0xff || (int16_t)(seqs[slot] - seqs[best]) > 0)
+				best = slot;
+		}
+		if (best == 0xff)
+			break;
+		tried |= 1 << best;
+
+		len = readRecord(best, &seq);
+		if (len) {
+			cur_slot = best;
+			cur_seq = seq;
+			return len;
+		}
+	}
+
+	return 0;
+}
+
+/* Load content written before slots. Returns its length or 0. */
+static int loadLegacy(void)
+{
+	eeprom_read_block(&g_eeprom_data, EEPROM_BASE_PTR, EEPROM_LEGACY_SIZE_NOCRC + 2);
+
+	if (g_eeprom_data.magic != EEPROM_MAGIC)
+		return 0;
+
+	if (!crc_matches(crc_block(0x0000, (uint8_t*)&g_eeprom_data, EEPROM_LEGACY_SIZE_NOCRC), EEPROM_LEGACY_SIZE_NOCRC))
+		return 0;
+
+	// Keep it until the next commit has succeeded.
+	cur_slot = 0;
+
+	return EEPROM_LEGACY_SIZE_NOCRC;
 }
 
-// return 1 if eeprom was blank
 void eeprom_init(void)
 {
-	eeprom_read_block(&g_eeprom_data, EEPROM_BASE_PTR, EEPROM_USED_SIZE);
+	struct eeprom_data_struct old;
+	int old_len;
+
+	cur_slot = EEPROM_SLOTS - 1;
+	cur_seq = 0;
+
+	old_len = loadNewest();
+	if (old_len == EEPROM_USED_SIZE_NOCRC) {
+		eeprom_app_ready();
+		return;
+	}
 
-	/* Detect new or corrupted content. Program default values if required. */
-	if ((g_eeprom_data.magic != EEPROM_MAGIC) || !isCrcValid())
-	{
-		memset(&g_eeprom_data, 0, EEPROM_USED_SIZE);
-		g_eeprom_data.magic = EEPROM_MAGIC;
+	if (!old_len) {
+		old_len = loadLegacy();
+	}
+
+	/* New, corrupted or older content. Start from the defaults
+	 * and keep the settings that were already there. */
+	memcpy(&old, &g_eeprom_data, sizeof(old));
 
-		// Call application code to set application defaults
-		eeprom_app_write_defaults();
+	memset(&g_eeprom_data, 0, EEPROM_USED_SIZE);
+	g_eeprom_data.magic = EEPROM_MAGIC;
 
-		// Write the now valid content to the EEPROM at once.
-		eeprom_commit();
+	// Call application code to set application defaults
+	eeprom_app_write_defaults();
+
+	// New fields keep their defaults.
+	if (old_len) {
+		memcpy(&g_eeprom_data, &old, old_len);
 	}
 
+	// Write the now valid content to the EEPROM at once.
+	eeprom_commit();
+
 	eeprom_app_ready();
 }
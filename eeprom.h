@@ -33,8 +33,19 @@ extern void eeprom_app_ready(void);
 /* Load, Validate and init eeprom if needed. */
 void eeprom_init(void);
 
-/* Commit changes made to g_eeprom_data */
+/* Commit changes made to g_eeprom_data. Blocks until written. */
 void eeprom_commit(void);
 
+/* Commit changes made to g_eeprom_data once no other change
+ * has been made for a while (see eeprom_poll). */
+void eeprom_commitLater(void);
+
+/* Start writing changes passed to eeprom_commitLater() now */
+void eeprom_flush(void);
+
+/* Call from the main loop. Writes deferred changes one byte
+ * at a time, without waiting for the EEPROM. */
+void eeprom_poll(void);
+
 #endif // _eeprom_h__
 
@@ -13,6 +13,9 @@ typedef struct {
 
 	void (*init)(void);
 	void (*update)(void);
+	// Optional. Called at each main loop iteration to complete
+	// work started by update(). Returns non-zero when new data was read.
+	char (*poll)(void);
 	char (*changed)(void);
 	void (*buildReport)(unsigned char *buf);
 
@@ -0,0 +1,78 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _sim_avr_eeprom_h__
+#define _sim_avr_eeprom_h__
+
+#include <stdint.h>
+#include <string.h>
+#include "sim.h"
+
+#define E2END	(sizeof(sim_eeprom) - 1)
+
+/* Byte writes take 3.4ms. Blocking functions wait for them, as
+ * avr-libc does, so the time spent shows in the simulation. */
+#define SIM_EEPROM_WRITE_CYCLES	((uint64_t)3400 * SIM_CYCLES_PER_US)
+extern uint64_t sim_eeprom_ready_at;
+
+#define eeprom_is_ready()	(sim_cycles >= sim_eeprom_ready_at)
+#define eeprom_busy_wait()	do { if (!eeprom_is_ready()) sim_delay_cycles(sim_eeprom_ready_at - sim_cycles); } while(0)
+
+static inline uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+	eeprom_busy_wait();
+	return sim_eeprom[(uintptr_t)addr];
+}
+
+static inline void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+	eeprom_busy_wait();
+	sim_eeprom[(uintptr_t)addr] = value;
+	sim_eeprom_ready_at = sim_cycles + SIM_EEPROM_WRITE_CYCLES;
+}
+
+static inline void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+	if (eeprom_read_byte(addr) != value)
+		eeprom_write_byte(addr, value);
+}
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	eeprom_busy_wait();
+	memcpy(dst, sim_eeprom + (uintptr_t)src, n);
+}
+
+static inline void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++)
+		eeprom_write_byte((uint8_t*)dst + i, ((const uint8_t*)src)[i]);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++)
+		eeprom_update_byte((uint8_t*)dst + i, ((const uint8_t*)src)[i]);
+}
+
+#endif
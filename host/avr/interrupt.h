@@ -0,0 +1,32 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _sim_avr_interrupt_h__
+#define _sim_avr_interrupt_h__
+
+#include "sim.h"
+
+/* Interrupt handlers are plain functions called by the simulation */
+#define ISR(vector, ...)	void vector(void)
+#define TWI_vect			sim_TWI_vect
+
+#define sei()	do { sim_SREG |= 0x80; } while(0)
+#define cli()	do { sim_SREG &= ~0x80; } while(0)
+
+#endif
@@ -0,0 +1,95 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _sim_avr_io_h__
+#define _sim_avr_io_h__
+
+/* ATmega8 registers for the host build. See sim.h */
+
+#include <stdint.h>
+#include "sim.h"
+
+#define _BV(b)	(1 << (b))
+
+extern volatile uint8_t sim_PORTB, sim_DDRB, sim_PINB;
+extern volatile uint8_t sim_PORTC, sim_DDRC;
+extern volatile uint8_t sim_PORTD, sim_DDRD, sim_PIND;
+extern volatile uint8_t sim_MCUCR, sim_GICR, sim_GIFR;
+extern volatile uint8_t sim_TWBR, sim_TWSR, sim_TWDR, sim_TWAR;
+extern volatile uint8_t sim_TCCR0, sim_TCCR1A, sim_TCCR1B, sim_TCCR2, sim_OCR2, sim_TIMSK;
+
+#define PORTB	sim_PORTB
+#define DDRB	sim_DDRB
+#define PINB	sim_PINB
+#define PORTC	sim_PORTC
+#define DDRC	sim_DDRC
+#define PINC	(sim_pinc())
+#define PORTD	sim_PORTD
+#define DDRD	sim_DDRD
+#define PIND	sim_PIND
+#define MCUCR	sim_MCUCR
+#define GICR	sim_GICR
+#define GIFR	sim_GIFR
+#define SREG	sim_SREG
+
+/* TWI */
+#define TWBR	sim_TWBR
+#define TWSR	sim_TWSR
+#define TWDR	sim_TWDR
+#define TWAR	sim_TWAR
+#define TWCR	(*sim_reg(SIM_TWCR))
+
+#define TWINT	7
+#define TWEA	6
+#define TWSTA	5
+#define TWSTO	4
+#define TWWC	3
+#define TWEN	2
+#define TWIE	0
+#define TWPS1	1
+#define TWPS0	0
+
+/* Timers */
+#define TCCR0	sim_TCCR0
+#define TCCR1A	sim_TCCR1A
+#define TCCR1B	sim_TCCR1B
+#define TCNT1	(*sim_tcnt1())
+#define TCCR2	sim_TCCR2
+#define OCR2	sim_OCR2
+#define TCNT2	(*sim_reg(SIM_TCNT2))
+#define TIFR	(*sim_reg(SIM_TIFR))
+#define TIMSK	sim_TIMSK
+
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define CS20	0
+#define CS21	1
+#define CS22	2
+#define WGM21	3
+#define OCF2	7
+#define TOV2	6
+
+/* External interrupts (V-USB) */
+#define INT0	6
+#define INTF0	6
+#define ISC00	0
+#define ISC01	1
+
+#endif
@@ -0,0 +1,42 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _sim_avr_wdt_h__
+#define _sim_avr_wdt_h__
+
+#define WDTO_15MS	0
+#define WDTO_30MS	1
+#define WDTO_60MS	2
+#define WDTO_120MS	3
+#define WDTO_250MS	4
+#define WDTO_500MS	5
+#define WDTO_1S		6
+#define WDTO_2S		7
+
+/* The main loop resets the watchdog. This is where the simulation
+ * advances time and runs scenarios. */
+void sim_wdt_reset(void);
+void sim_wdt_enable(unsigned char timeout);
+void sim_wdt_disable(void);
+
+#define wdt_reset()		sim_wdt_reset()
+#define wdt_enable(t)	sim_wdt_enable(t)
+#define wdt_disable()	sim_wdt_disable()
+
+#endif
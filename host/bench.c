@@ -0,0 +1,293 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+
+/* wusbmote-bench: Input to report latency, measured in virtual time.
+ *
+ * For each configuration, the firmware is started in a child process
+ * (its state lives in static variables) with a virtual Nunchuk. The Z
+ * button is then toggled at pseudo-random times, and the time until the
+ * new state is handed to usbSetInterrupt() and until the host receives
+ * it is recorded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include "sim.h"
+#include "sim_w2i.h"
+#include "eeprom.h"
+#include "wusbmote_requests.h"
+
+#define CONNECT_TIME_MS		500
+#define TIMEOUT_MS			200
+
+struct bench_cfg {
+	unsigned char mode;
+	unsigned char poll_rate;
+	unsigned char low_latency;
+	unsigned char sync_host;
+};
+
+static const char *mode_names[] = { "joystick", "mouse" };
+static const int rate_hz[] = { 60, 125, 250, 500, 1000 };
+
+static int samples = 1000;
+static unsigned long seed = 1;
+
+/* Where the Z button appears in the report, for each mode */
+static const struct { int byte; unsigned char mask; } z_location[] = {
+	[CFG_MODE_JOYSTICK] = { 6, 0x01 },
+	[CFG_MODE_MOUSE] = { 0, 0x01 },
+};
+
+static struct bench_cfg cur;
+static int z;				// current Z state
+static uint64_t next_change;
+static uint64_t changed_at;	// 0 when not waiting for a report
+static char seen_interrupt;
+static int done, timeouts;
+static uint32_t *to_interrupt, *to_host;	// latencies in cycles
+
+static unsigned long rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+static void scheduleChange(void)
+{
+	/* 5 to 25ms later, at a time unrelated to the poll timers */
+	next_change = sim_cycles + (5000 + rnd() * 20000 / 0x8000) * SIM_CYCLES_PER_US
+						+ rnd() % SIM_CYCLES_PER_US;
+	changed_at = 0;
+}
+
+static char showsChange(const unsigned char *data, int len)
+{
+	int byte = z_location[cur.mode].byte;
+	char state;
+
+	if (!changed_at || len <= byte)
+		return 0;
+
+	state = (data[byte] & z_location[cur.mode].mask) != 0;
+
+	return state == z;
+}
+
+static void interruptHook(const unsigned char *data, int len)
+{
+	if (showsChange(data, len) && !seen_interrupt) {
+		seen_interrupt = 1;
+		to_interrupt[done] = sim_cycles - changed_at;
+	}
+}
+
+static void reportHook(const unsigned char *data, int len)
+{
+	if (showsChange(data, len)) {
+		if (!seen_interrupt) {
+			to_interrupt[done] = sim_cycles - changed_at;
+		}
+		to_host[done] = sim_cycles - changed_at;
+		done++;
+		scheduleChange();
+	}
+}
+
+static void loopHook(void)
+{
+	if (done >= samples)
+		sim_stop();
+
+	if (changed_at) {
+		if (sim_cycles - changed_at > (uint64_t)TIMEOUT_MS * 1000 * SIM_CYCLES_PER_US) {
+			timeouts++;
+			scheduleChange();
+		}
+		return;
+	}
+
+	if (sim_cycles >= next_change) {
+		z = !z;
+		sim_w2i_set("z", z);
+		changed_at = sim_cycles;
+		seen_interrupt = 0;
+	}
+}
+
+static int cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void printStats(uint32_t *values, int n)
+{
+	double us = SIM_CYCLES_PER_US;
+
+	if (!n) {
+		printf("%8s %8s %8s %8s", "-", "-", "-", "-");
+		return;
+	}
+
+	qsort(values, n, sizeof(values[0]), cmp);
+	printf("%8.0f %8.0f %8.0f %8.0f", values[0] / us, values[n/2] / us,
+			values[(n * 99) / 100] / us, values[n-1] / us);
+}
+
+static void runConfig(const struct bench_cfg *cfg)
+{
+	cur = *cfg;
+
+	memset(sim_eeprom, 0xff, sizeof(sim_eeprom));
+	eeprom_init();
+	g_eeprom_data.cfg.mode = cfg->mode;
+	g_eeprom_data.cfg.poll_rate = cfg->poll_rate;
+	g_eeprom_data.cfg.low_latency = cfg->low_latency;
+	g_eeprom_data.cfg.sync_host = cfg->sync_host;
+	eeprom_commit();
+
+	to_interrupt = calloc(samples, sizeof(uint32_t));
+	to_host = calloc(samples, sizeof(uint32_t));
+
+	sim_w2i_connect(SIM_W2I_NUNCHUK);
+	sim_interrupt_hook = interruptHook;
+	sim_report_hook = reportHook;
+	sim_loop_hook = loopHook;
+	next_change = (uint64_t)CONNECT_TIME_MS * 1000 * SIM_CYCLES_PER_US;
+
+	sim_run();
+
+	printf("%-8s %5d %4d %4s  ", mode_names[cfg->mode], rate_hz[cfg->poll_rate],
+			sim_usb_interval(), cfg->sync_host ? "yes" : "no");
+	printStats(to_interrupt, done);
+	printf("  ");
+	printStats(to_host, done);
+	if (timeouts)
+		printf("  (%d timeouts)", timeouts);
+	printf("\n");
+}
+
+static void benchConfig(const struct bench_cfg *cfg)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		runConfig(cfg);
+		fflush(stdout);
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n", name);
+	printf("\n");
+	printf("Without options, all modes, poll rates and intervals are measured.\n");
+	printf("\n");
+	printf("  -m mode    joystick or mouse\n");
+	printf("  -r hz      Poll rate: 60, 125, 250, 500 or 1000\n");
+	printf("  -i ms      Endpoint interval: 10 or 1\n");
+	printf("  -s         Also measure with host poll synchronisation\n");
+	printf("  -H ms      Host polling interval, instead of the endpoint interval\n");
+	printf("  -n count   Number of samples per configuration (default: %d)\n", samples);
+	printf("  -S seed    Seed for the input change times (default: %lu)\n", seed);
+}
+
+int main(int argc, char **argv)
+{
+	int mode = -1, rate = -1, interval = -1, sync = 0;
+	struct bench_cfg cfg;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "m:r:i:sH:n:S:h")) != -1) {
+		switch (opt)
+		{
+			case 'm':
+				for (mode = 0; mode < 2 && strcmp(mode_names[mode], optarg); mode++)
+					;
+				if (mode == 2) {
+					fprintf(stderr, "Unknown mode\n");
+					return 1;
+				}
+				break;
+			case 'r':
+				for (rate = 0; rate < 5 && rate_hz[rate] != atoi(optarg); rate++)
+					;
+				if (rate == 5) {
+					fprintf(stderr, "Unsupported poll rate\n");
+					return 1;
+				}
+				break;
+			case 'i':
+				interval = atoi(optarg);
+				if (interval != 1 && interval != 10) {
+					fprintf(stderr, "Interval must be 1 or 10\n");
+					return 1;
+				}
+				break;
+			case 's': sync = 1; break;
+			case 'H': sim_usb_host_interval = atoi(optarg); break;
+			case 'n': samples = atoi(optarg); break;
+			case 'S': seed = strtoul(optarg, NULL, 0); break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	printf("%-8s %5s %4s %4s  %-35s  %-35s\n", "", "poll", "intv", "", "to usbSetInterrupt (us)", "to host (us)");
+	printf("%-8s %5s %4s %4s  %8s %8s %8s %8s  %8s %8s %8s %8s\n", "mode", "Hz", "ms", "sync",
+			"min", "median", "p99", "max", "min", "median", "p99", "max");
+
+	for (cfg.mode = 0; cfg.mode < 2; cfg.mode++) {
+		if (mode >= 0 && cfg.mode != mode)
+			continue;
+		for (i = 0; i < 2; i++) {
+			cfg.low_latency = i;
+			if (interval >= 0 && (interval == 1) != i)
+				continue;
+			for (cfg.poll_rate = 0; cfg.poll_rate < 5; cfg.poll_rate++) {
+				if (rate >= 0 && cfg.poll_rate != rate)
+					continue;
+				cfg.sync_host = 0;
+				benchConfig(&cfg);
+				if (sync) {
+					cfg.sync_host = 1;
+					benchConfig(&cfg);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,396 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+
+/* Simulated CPU time, TWI controller and timers for the host build.
+ * See sim.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <util/twi.h>
+#include "sim.h"
+
+volatile uint8_t sim_PORTB, sim_DDRB, sim_PINB;
+volatile uint8_t sim_PORTC, sim_DDRC;
+volatile uint8_t sim_PORTD, sim_DDRD, sim_PIND;
+volatile uint8_t sim_MCUCR, sim_GICR, sim_GIFR;
+volatile uint8_t sim_TWBR, sim_TWSR = TW_NO_INFO, sim_TWDR, sim_TWAR;
+volatile uint8_t sim_TCCR0, sim_TCCR1A, sim_TCCR1B, sim_TCCR2, sim_OCR2, sim_TIMSK;
+uint8_t sim_SREG;
+uint8_t sim_eeprom[512];
+uint64_t sim_eeprom_ready_at;
+
+uint64_t sim_cycles;
+unsigned int sim_access_cycles = 4;
+unsigned int sim_loop_cycles = 200;
+
+void (*sim_loop_hook)(void);
+
+#define SENTINEL	0x8000
+static volatile uint16_t regs[SIM_NUM_REGS];
+static volatile uint16_t tcnt1;
+
+static char syncing;
+static char in_twi_isr;
+
+extern void sim_TWI_vect(void);
+extern int firmware_main(void);
+
+/**** TWI controller ****/
+
+#define MAX_DEVS	4
+static struct sim_i2c_dev *devs[MAX_DEVS];
+
+static struct sim_i2c_dev *twi_dev;	// addressed device
+static char twi_started;		// bus owned (start sent, no stop yet)
+static char twi_expect_sla;		// next byte is the address
+static char twi_reading;
+static uint8_t twi_status;		// TWSR value at completion
+static uint64_t twi_done;		// completion time of the current operation, 0 if none
+static uint64_t twi_stop_done;	// time the stop condition ends (TWSTO clears)
+static char scl_low;			// SCL driven low by the firmware (bus recovery)
+
+int sim_i2c_stuck;
+
+void sim_i2c_attach(struct sim_i2c_dev *dev)
+{
+	int i;
+
+	for (i=0; i<MAX_DEVS; i++) {
+		if (!devs[i]) {
+			devs[i] = dev;
+			return;
+		}
+	}
+	fprintf(stderr, "Too many I2C devices\n");
+	exit(1);
+}
+
+void sim_i2c_detach(struct sim_i2c_dev *dev)
+{
+	int i;
+
+	for (i=0; i<MAX_DEVS; i++) {
+		if (devs[i] == dev)
+			devs[i] = NULL;
+	}
+	if (twi_dev == dev)
+		twi_dev = NULL;
+}
+
+static uint64_t sclPeriod(void)
+{
+	static const int prescalers[] = { 1, 4, 16, 64 };
+
+	return 16 + 2 * sim_TWBR * prescalers[sim_TWSR & 3];
+}
+
+unsigned long sim_i2c_sclHz(void)
+{
+	return F_CPU / sclPeriod();
+}
+
+static struct sim_i2c_dev *findDev(unsigned char addr)
+{
+	int i;
+
+	for (i=0; i<MAX_DEVS; i++) {
+		if (devs[i] && devs[i]->addr == addr)
+			return devs[i];
+	}
+	return NULL;
+}
+
+static void twiStop(void)
+{
+	if (twi_dev && twi_dev->stop)
+		twi_dev->stop(twi_dev);
+	twi_dev = NULL;
+	twi_started = 0;
+}
+
+/* Called when TWCR is written */
+static void twiControl(uint8_t twcr)
+{
+	if (!(twcr & (1<<TWEN))) {
+		// Module disabled: releases the bus.
+		if (twi_started)
+			twiStop();
+		twi_done = 0;
+		twi_stop_done = 0;
+		regs[SIM_TWCR] = twcr;
+		return;
+	}
+
+	// Writing one clears TWINT and starts the next operation
+	if (!(twcr & (1<<TWINT))) {
+		regs[SIM_TWCR] = twcr | (regs[SIM_TWCR] & (1<<TWINT));
+		return;
+	}
+	regs[SIM_TWCR] = twcr & ~(1<<TWINT);
+
+	if (twcr & (1<<TWSTA)) {
+		// No start condition can be made while SDA is held low
+		if (sim_i2c_stuck) {
+			twi_done = 0;
+			return;
+		}
+
+		// A repeated start is seen by the device as a new start() without stop()
+		twi_status = twi_started ? TW_REP_START : TW_START;
+		twi_dev = NULL;
+		twi_started = 1;
+		twi_expect_sla = 1;
+		twi_done = sim_cycles + sclPeriod();
+		return;
+	}
+
+	if (twcr & (1<<TWSTO)) {
+		twiStop();
+		twi_done = 0;
+		twi_stop_done = sim_cycles + sclPeriod() / 2;
+		return;
+	}
+
+	if (!twi_started) {
+		twi_status = TW_BUS_ERROR;
+		twi_done = sim_cycles + 1;
+		return;
+	}
+
+	// Address or data byte and the acknowledge bit
+	twi_done = sim_cycles + sclPeriod() * 9;
+
+	if (twi_expect_sla) {
+		twi_expect_sla = 0;
+		twi_reading = sim_TWDR & 1;
+		twi_dev = findDev(sim_TWDR >> 1);
+		if (twi_dev && !twi_dev->start(twi_dev, twi_reading))
+			twi_dev = NULL;
+
+		if (twi_reading)
+			twi_status = twi_dev ? TW_MR_SLA_ACK : TW_MR_SLA_NACK;
+		else
+			twi_status = twi_dev ? TW_MT_SLA_ACK : TW_MT_SLA_NACK;
+		return;
+	}
+
+	if (twi_reading) {
+		sim_TWDR = twi_dev ? twi_dev->read(twi_dev) : 0xff;
+		twi_status = (twcr & (1<<TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+	} else {
+		if (twi_dev && twi_dev->write(twi_dev, sim_TWDR))
+			twi_status = TW_MT_DATA_ACK;
+		else
+			twi_status = TW_MT_DATA_NACK;
+	}
+}
+
+static void twiUpdate(void)
+{
+	if (twi_done && sim_cycles >= twi_done) {
+		twi_done = 0;
+		sim_TWSR = (sim_TWSR & 3) | twi_status;
+		regs[SIM_TWCR] |= (1<<TWINT);
+	}
+
+	if (twi_stop_done && sim_cycles >= twi_stop_done) {
+		twi_stop_done = 0;
+		regs[SIM_TWCR] &= ~(1<<TWSTO);
+		sim_TWSR = (sim_TWSR & 3) | TW_NO_INFO;
+	}
+}
+
+/* SCL and SDA as general purpose I/O (PC5 and PC4), for bus recovery.
+ * Each time SCL is released, a device holding SDA gets closer to
+ * the end of its byte. */
+static void busUpdate(void)
+{
+	char low = (sim_DDRC & ~sim_PORTC & (1<<5)) != 0;
+
+	if (scl_low && !low && sim_i2c_stuck)
+		sim_i2c_stuck--;
+	scl_low = low;
+}
+
+/**** Timers ****/
+
+static uint64_t t2_next;	// next compare match, 0 to recompute
+
+static unsigned int t2Prescaler(void)
+{
+	static const unsigned int prescalers[] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+	return prescalers[sim_TCCR2 & 7];
+}
+
+static void timersUpdate(void)
+{
+	uint64_t period = (uint64_t)t2Prescaler() * (sim_OCR2 + 1);
+
+	tcnt1 = sim_TCCR1B & (1<<CS12) ? sim_cycles / 256 : 0;
+
+	if (!period)
+		return;
+
+	if (!t2_next)
+		t2_next = sim_cycles + period;
+
+	if (sim_cycles >= t2_next) {
+		regs[SIM_TIFR] |= (1<<OCF2);
+		while (t2_next <= sim_cycles)
+			t2_next += period;
+	}
+}
+
+/* A write to the register was detected */
+static void regWritten(int reg, uint8_t value)
+{
+	switch (reg)
+	{
+		case SIM_TWCR:
+			twiControl(value);
+			break;
+		case SIM_TIFR:
+			// Flags are cleared by writing one
+			regs[SIM_TIFR] = 0;
+			break;
+		case SIM_TCNT2:
+			t2_next = 0;
+			regs[SIM_TCNT2] = 0;
+			break;
+	}
+}
+
+static void sync(void)
+{
+	int i;
+
+	if (syncing)
+		return;
+	syncing = 1;
+
+	for (i=0; i<SIM_NUM_REGS; i++) {
+		if (!(regs[i] & SENTINEL)) {
+			regWritten(i, regs[i]);
+		}
+		regs[i] |= SENTINEL;
+	}
+
+	twiUpdate();
+	busUpdate();
+	timersUpdate();
+	sim_usb_process();
+
+	syncing = 0;
+
+	if ((sim_SREG & 0x80) && !in_twi_isr) {
+		while ((regs[SIM_TWCR] & ((1<<TWINT)|(1<<TWIE)|(1<<TWEN))) == ((1<<TWINT)|(1<<TWIE)|(1<<TWEN))) {
+			in_twi_isr = 1;
+			sim_SREG &= ~0x80;
+			sim_TWI_vect();
+			sim_SREG |= 0x80;
+			in_twi_isr = 0;
+
+			// Apply what the handler wrote
+			sync();
+		}
+	}
+}
+
+volatile uint16_t *sim_reg(int reg)
+{
+	sim_cycles += sim_access_cycles;
+	sync();
+	return &regs[reg];
+}
+
+volatile uint16_t *sim_tcnt1(void)
+{
+	sim_cycles += sim_access_cycles;
+	sync();
+	return &tcnt1;
+}
+
+uint8_t sim_pinc(void)
+{
+	uint8_t pins;
+
+	sim_cycles += sim_access_cycles;
+	sync();
+
+	// Released pins are pulled high
+	pins = ~(sim_DDRC & ~sim_PORTC);
+	if (sim_i2c_stuck)
+		pins &= ~(1<<4);
+
+	return pins;
+}
+
+void sim_delay_cycles(uint64_t cycles)
+{
+	uint64_t end = sim_cycles + cycles;
+
+	/* Small steps, so interrupts and the host get a chance to run */
+	while (sim_cycles < end) {
+		sim_cycles += 12;
+		sync();
+	}
+}
+
+/**** Main loop ****/
+
+static jmp_buf stop_jmp;
+
+void sim_wdt_reset(void)
+{
+	sim_cycles += sim_loop_cycles;
+	sync();
+
+	if (sim_loop_hook)
+		sim_loop_hook();
+}
+
+/* The firmware only enables the watchdog to restart the device. Static
+ * state can't be reset on the host, so the simulation ends there. */
+void sim_wdt_enable(unsigned char timeout)
+{
+	printf("%10.3f watchdog restart\n", sim_time_us() / 1000.0);
+	sim_stop();
+}
+
+void sim_wdt_disable(void)
+{
+}
+
+void sim_run(void)
+{
+	if (!setjmp(stop_jmp)) {
+		firmware_main();
+	}
+}
+
+void sim_stop(void)
+{
+	longjmp(stop_jmp, 1);
+}
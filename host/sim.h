@@ -0,0 +1,115 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _sim_h__
+#define _sim_h__
+
+/* Host simulation of the ATmega8 peripherals used by the firmware.
+ *
+ * Registers the simulation must react to are accessed through sim_reg(),
+ * which first brings the simulated hardware up to date (virtual time,
+ * pending register writes, interrupts). Those registers are stored in 16
+ * bits with the top bit set by sim_reg(). The firmware only ever stores 8
+ * bit values, so a cleared top bit at the next access means the register
+ * was written.
+ *
+ * Virtual time only moves when the firmware touches simulated hardware,
+ * waits (_delay_*) or goes around the main loop (usbPoll).
+ */
+
+#include <stdint.h>
+
+/* Registers with side effects */
+#define SIM_TWCR	0
+#define SIM_TIFR	1
+#define SIM_TCNT2	2
+#define SIM_NUM_REGS	3
+
+volatile uint16_t *sim_reg(int reg);
+volatile uint16_t *sim_tcnt1(void);
+
+/* Virtual time, in CPU cycles */
+extern uint64_t sim_cycles;
+#define SIM_CYCLES_PER_US	(F_CPU / 1000000)
+#define sim_time_us()		(sim_cycles / SIM_CYCLES_PER_US)
+
+/* Cost of a simulated register access, and of a trip around the main loop */
+extern unsigned int sim_access_cycles;
+extern unsigned int sim_loop_cycles;
+
+void sim_delay_cycles(uint64_t cycles);
+#define sim_delay_us(us)	sim_delay_cycles((uint64_t)((us) * SIM_CYCLES_PER_US))
+
+/* Called from the firmware main loop (wdt_reset). Scenarios run
+ * from here, and call sim_stop() when done. */
+extern void (*sim_loop_hook)(void);
+
+/* Run the firmware until sim_stop() is called. Can only be done once per
+ * process since the firmware keeps its state in static variables. */
+void sim_run(void);
+void sim_stop(void);
+
+extern uint8_t sim_SREG;
+extern uint8_t sim_eeprom[512];
+
+/**** I2C bus ****/
+
+struct sim_i2c_dev {
+	unsigned char addr;
+	/* Returns non-zero to acknowledge the address */
+	char (*start)(struct sim_i2c_dev *dev, char read);
+	/* Returns non-zero to acknowledge the byte */
+	char (*write)(struct sim_i2c_dev *dev, unsigned char b);
+	unsigned char (*read)(struct sim_i2c_dev *dev);
+	void (*stop)(struct sim_i2c_dev *dev);
+	void *priv;
+};
+
+void sim_i2c_attach(struct sim_i2c_dev *dev);
+void sim_i2c_detach(struct sim_i2c_dev *dev);
+/* Current SCL frequency, from TWBR */
+unsigned long sim_i2c_sclHz(void);
+/* When non-zero, SDA is held low (as by a device interrupted in the
+ * middle of a byte) until this many SCL pulses are seen */
+extern int sim_i2c_stuck;
+/* PINC: SDA and SCL levels */
+uint8_t sim_pinc(void);
+
+/**** USB host ****/
+
+/* Called when the host takes a report from endpoint 1 */
+extern void (*sim_report_hook)(const unsigned char *data, int len);
+/* Called when the firmware hands a report to usbSetInterrupt() */
+extern void (*sim_interrupt_hook)(const unsigned char *data, int len);
+/* Phase of the host interrupt polls relative to time 0 */
+extern unsigned int sim_usb_poll_phase_us;
+/* Endpoint 1 polling interval of the host in ms, instead of the one in the
+ * configuration descriptor (hosts may poll less often). 0 to follow it. */
+extern unsigned char sim_usb_host_interval;
+/* Endpoint 1 polling interval in use by the host */
+unsigned char sim_usb_interval(void);
+
+/* Control transfers. Return the number of bytes transferred, or -1 on stall. */
+int sim_usb_setReport(unsigned char iface, const unsigned char *data, int len);
+int sim_usb_getReport(unsigned char iface, unsigned char type, unsigned char *dst, int len);
+
+/* Called by the simulated hardware as time passes */
+void sim_usb_process(void);
+
+#endif // _sim_h__
@@ -0,0 +1,320 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+
+/* wusbmote-sim: Runs the firmware on the host against a virtual
+ * accessory and USB host, following a script. Reports taken by the host
+ * are printed with a time stamp.
+ *
+ * Script commands (one per line, # starts a comment):
+ *
+ *   cfg name value        Preset a configuration field (before the first run)
+ *   accessory type        Connect an accessory: none, nunchuk, classic, mplus
+ *   set input value       Change an accessory input (sx, sy, c, z, lx, a, home...)
+ *   cal reg value         Write a calibration byte (0x20-0x2f, 0x30-0x3f) and update
+ *                         the checksum of its block, unless it is a checksum byte
+ *   stuck pulses          SDA held low until that many SCL pulses (hot unplug glitch)
+ *   timing khz us rs      Accessory bus limits: max SCL kHz, turnaround, repeated start
+ *   feature b0 .. b4      Send a configuration command (feature report, interface 1)
+ *                         and print the reply
+ *   config                Read the configuration over USB and print it
+ *   setconfig name value  Change a configuration field over USB (the whole
+ *                         configuration is read, then written back)
+ *   raw b0 .. b6          Send a command to the raw I2C interface (interface 0)
+ *   rawresult             Print the raw I2C interface reply
+ *   hostphase us          Delay of the first host poll (before the first run)
+ *   hostinterval ms       Host polling interval, instead of the one in the
+ *                         descriptor (before the first run)
+ *   run ms                Let the firmware run
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "sim.h"
+#include "sim_w2i.h"
+#include "eeprom.h"
+#include "wusbmote_requests.h"
+
+static FILE *script;
+static const char *script_name;
+static int lineno;
+static char booted;
+static uint64_t run_until;
+
+static const struct {
+	const char *name;
+	int offset;
+} cfg_fields[] = {
+	{ "mode", offsetof(struct eeprom_cfg, mode) },
+	{ "mouse_divisor", offsetof(struct eeprom_cfg, mouse_divisor) },
+	{ "mouse_deadzone", offsetof(struct eeprom_cfg, mouse_deadzone) },
+	{ "scroll_joystick_invert", offsetof(struct eeprom_cfg, scroll_joystick_invert) },
+	{ "scroll_nunchuck_invert", offsetof(struct eeprom_cfg, scroll_nunchuck_invert) },
+	{ "scroll_nunchuck_threshold", offsetof(struct eeprom_cfg, scroll_nunchuck_threshold) },
+	{ "scroll_nunchuck_step", offsetof(struct eeprom_cfg, scroll_nunchuck_step) },
+	{ "scroll_nunchuck_c", offsetof(struct eeprom_cfg, scroll_nunchuck_c) },
+	{ "scroll_nunchuck_c_threshold", offsetof(struct eeprom_cfg, scroll_nunchuck_c_threshold) },
+	{ "poll_rate", offsetof(struct eeprom_cfg, poll_rate) },
+	{ "low_latency", offsetof(struct eeprom_cfg, low_latency) },
+	{ "sync_host", offsetof(struct eeprom_cfg, sync_host) },
+	{ "profile", offsetof(struct eeprom_cfg, profile) },
+};
+
+static void fail(const char *msg)
+{
+	fprintf(stderr, "%s:%d: %s\n", script_name, lineno, msg);
+	exit(1);
+}
+
+static void printTime(void)
+{
+	printf("%10.3f ", sim_cycles / (SIM_CYCLES_PER_US * 1000.0));
+}
+
+static void reportTaken(const unsigned char *data, int len)
+{
+	int i;
+
+	printTime();
+	printf("report");
+	for (i=0; i<len; i++) {
+		printf(" %02x", data[i]);
+	}
+	printf("\n");
+}
+
+/* Offset of a field in struct eeprom_cfg */
+static int findField(const char *name)
+{
+	int i;
+
+	for (i=0; i<sizeof(cfg_fields)/sizeof(cfg_fields[0]); i++) {
+		if (!strcmp(cfg_fields[i].name, name))
+			return cfg_fields[i].offset;
+	}
+	fail("unknown configuration field");
+	return -1;
+}
+
+static void presetConfig(const char *name, int value)
+{
+	if (booted)
+		fail("cfg must be used before the first run");
+
+	((uint8_t*)&g_eeprom_data.cfg)[findField(name)] = value;
+	eeprom_commit();
+}
+
+/* GET_CONFIG, change one byte, SET_CONFIG with the same block */
+static void setConfig(const char *name, int value)
+{
+	unsigned char data[CONFIG_REPORT_SIZE] = { RQ_WUSBMOTE_GET_CONFIG };
+	int offset = findField(name);
+
+	printTime();
+	if (sim_usb_setReport(1, data, sizeof(data)) < 0 ||
+		sim_usb_getReport(1, 3, data, sizeof(data)) != sizeof(data) ||
+		data[0] != RQ_WUSBMOTE_GET_CONFIG) {
+		printf("setconfig failed\n");
+		return;
+	}
+
+	data[0] = RQ_WUSBMOTE_SET_CONFIG;
+	data[2 + offset] = value;
+	printf("setconfig %s\n", sim_usb_setReport(1, data, sizeof(data)) < 0 ? "stall" : "ok");
+}
+
+/* Execute commands up to the next 'run'. Returns 0 at the end of the script. */
+static char runScript(void)
+{
+	char line[256];
+	char *argv[8];
+	int argc;
+
+	while (fgets(line, sizeof(line), script)) {
+		char *p;
+
+		lineno++;
+		if ((p = strchr(line, '#')))
+			*p = 0;
+
+		for (argc = 0, p = strtok(line, " \t\r\n"); p && argc < 8; p = strtok(NULL, " \t\r\n")) {
+			argv[argc++] = p;
+		}
+		if (!argc)
+			continue;
+
+		if (!strcmp(argv[0], "run") && argc == 2) {
+			run_until = sim_cycles + (uint64_t)(atof(argv[1]) * 1000 * SIM_CYCLES_PER_US);
+			return 1;
+		}
+		else if (!strcmp(argv[0], "cfg") && argc == 3) {
+			presetConfig(argv[1], strtol(argv[2], NULL, 0));
+		}
+		else if (!strcmp(argv[0], "accessory") && argc == 2) {
+			int type = sim_w2i_typeByName(argv[1]);
+			if (type < 0)
+				fail("unknown accessory");
+			printTime();
+			printf("accessory %s\n", argv[1]);
+			sim_w2i_connect(type);
+		}
+		else if (!strcmp(argv[0], "set") && argc == 3) {
+			if (sim_w2i_set(argv[1], strtol(argv[2], NULL, 0)))
+				fail("the accessory has no such input");
+			printTime();
+			printf("set %s %s\n", argv[1], argv[2]);
+		}
+		else if (!strcmp(argv[0], "cal") && argc == 3) {
+			if (sim_w2i_calibrate(strtol(argv[1], NULL, 0), strtol(argv[2], NULL, 0)))
+				fail("not a calibration register");
+		}
+		else if (!strcmp(argv[0], "stuck") && argc == 2) {
+			// The accessory is unplugged and back in the middle of a byte
+			printTime();
+			printf("SDA stuck for %s SCL pulses\n", argv[1]);
+			sim_i2c_stuck = atoi(argv[1]);
+		}
+		else if (!strcmp(argv[0], "timing") && argc == 4) {
+			sim_w2i_timing(atol(argv[1]) * 1000, atoi(argv[2]), atoi(argv[3]));
+		}
+		else if (!strcmp(argv[0], "feature") && argc > 1) {
+			unsigned char data[5] = { };
+			int i;
+
+			for (i=1; i<argc && i<=5; i++) {
+				data[i-1] = strtol(argv[i], NULL, 0);
+			}
+			printTime();
+			if (sim_usb_setReport(1, data, 5) < 0) {
+				printf("feature stall\n");
+				continue;
+			}
+			/* Reading back gives the reply to the command */
+			sim_usb_getReport(1, 3, data, 5);
+			printf("feature ok, reply %02x %02x %02x %02x %02x\n",
+						data[0], data[1], data[2], data[3], data[4]);
+		}
+		else if (!strcmp(argv[0], "config") && argc == 1) {
+			unsigned char data[CONFIG_REPORT_SIZE] = { RQ_WUSBMOTE_GET_CONFIG };
+			int i;
+
+			printTime();
+			if (sim_usb_setReport(1, data, sizeof(data)) < 0 ||
+				sim_usb_getReport(1, 3, data, sizeof(data)) != sizeof(data) ||
+				data[0] != RQ_WUSBMOTE_GET_CONFIG) {
+				printf("config failed\n");
+				continue;
+			}
+			printf("config");
+			for (i=0; i<sizeof(cfg_fields)/sizeof(cfg_fields[0]); i++) {
+				printf(" %s=%d", cfg_fields[i].name, data[2 + cfg_fields[i].offset]);
+			}
+			printf("\n");
+		}
+		else if (!strcmp(argv[0], "setconfig") && argc == 3) {
+			setConfig(argv[1], strtol(argv[2], NULL, 0));
+		}
+		else if (!strcmp(argv[0], "raw") && argc > 1) {
+			unsigned char data[7] = { };
+			int i;
+
+			for (i=1; i<argc && i<=7; i++) {
+				data[i-1] = strtol(argv[i], NULL, 0);
+			}
+			printTime();
+			printf("raw %s\n", sim_usb_setReport(0, data, 7) < 0 ? "stall" : "sent");
+		}
+		else if (!strcmp(argv[0], "rawresult") && argc == 1) {
+			unsigned char data[7] = { };
+			int i;
+
+			printTime();
+			if (sim_usb_getReport(0, 3, data, 7) != 7) {
+				printf("rawresult failed\n");
+				continue;
+			}
+			printf("rawresult");
+			for (i=0; i<7; i++) {
+				printf(" %02x", data[i]);
+			}
+			printf("\n");
+		}
+		else if (!strcmp(argv[0], "hostphase") && argc == 2) {
+			if (booted)
+				fail("hostphase must be used before the first run");
+			sim_usb_poll_phase_us = atoi(argv[1]);
+		}
+		else if (!strcmp(argv[0], "hostinterval") && argc == 2) {
+			if (booted)
+				fail("hostinterval must be used before the first run");
+			sim_usb_host_interval = atoi(argv[1]);
+		}
+		else {
+			fail("syntax error");
+		}
+	}
+
+	return 0;
+}
+
+static void loopHook(void)
+{
+	if (sim_cycles < run_until)
+		return;
+
+	if (!runScript())
+		sim_stop();
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s script\n", argv[0]);
+		return 1;
+	}
+
+	script_name = argv[1];
+	script = fopen(script_name, "r");
+	if (!script) {
+		perror(script_name);
+		return 1;
+	}
+
+	/* Blank EEPROM. Defaults are written right away so that cfg can
+	 * modify them before the firmware starts. */
+	memset(sim_eeprom, 0xff, sizeof(sim_eeprom));
+	eeprom_init();
+
+	sim_w2i_connect(SIM_W2I_NUNCHUK);
+	sim_report_hook = reportTaken;
+
+	if (!runScript())
+		return 0;
+
+	booted = 1;
+	sim_loop_hook = loopHook;
+	sim_run();
+
+	fclose(script);
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+
+/* Replaces V-USB in the host build. The simulated host polls endpoint 1
+ * at the interval found in the configuration descriptor (unless told
+ * otherwise) and can perform HID feature report transfers on either
+ * interface. */
+
+#include <stdio.h>
+#include <string.h>
+#include "usbdrv.h"
+#include "sim.h"
+
+usbMsgPtr_t usbMsgPtr;
+uchar usbConfiguration;
+usbTxStatus_t usbTxStatus1, usbTxStatus3;
+
+void (*sim_report_hook)(const unsigned char *data, int len);
+void (*sim_interrupt_hook)(const unsigned char *data, int len);
+unsigned int sim_usb_poll_phase_us;
+unsigned char sim_usb_host_interval;
+
+static char configured;
+static unsigned char interval = 10;
+static uint64_t next_poll;
+static unsigned char ep1_data[8];
+static unsigned char ep1_len;
+
+static void usbEnumerate(void)
+{
+	usbRequest_t rq;
+	unsigned char len;
+
+	/* Fetch the configuration descriptor like the host would, to learn
+	 * the endpoint 1 polling interval. */
+	memset(&rq, 0, sizeof(rq));
+	rq.bmRequestType = USBRQ_DIR_DEVICE_TO_HOST | USBRQ_TYPE_STANDARD;
+	rq.bRequest = USBRQ_GET_DESCRIPTOR;
+	rq.wValue.bytes[1] = USBDESCR_CONFIG;
+
+	len = usbFunctionDescriptor(&rq);
+	if (len >= 34 && usbMsgPtr[27+1] == USBDESCR_ENDPOINT && usbMsgPtr[27+2] == 0x81) {
+		interval = usbMsgPtr[27+6];
+	}
+	if (sim_usb_host_interval)
+		interval = sim_usb_host_interval;
+	if (!interval)
+		interval = 1;
+
+	next_poll = (uint64_t)sim_usb_poll_phase_us * SIM_CYCLES_PER_US;
+	while (next_poll < sim_cycles)
+		next_poll += (uint64_t)interval * 1000 * SIM_CYCLES_PER_US;
+
+	usbConfiguration = 1;
+	configured = 1;
+}
+
+void usbInit(void)
+{
+	usbTxLen1 = USBPID_NAK;
+	usbTxLen3 = USBPID_NAK;
+	configured = 0;
+}
+
+void usbPoll(void)
+{
+	if (!configured)
+		usbEnumerate();
+}
+
+void usbSetInterrupt(uchar *data, uchar len)
+{
+	memcpy(ep1_data, data, len);
+	ep1_len = len;
+	usbTxLen1 = len + 4;
+
+	if (sim_interrupt_hook)
+		sim_interrupt_hook(data, len);
+}
+
+void usbSetInterrupt3(uchar *data, uchar len)
+{
+	// Nothing reads endpoint 3
+	usbTxLen3 = USBPID_NAK;
+}
+
+unsigned char sim_usb_interval(void)
+{
+	return interval;
+}
+
+void sim_usb_process(void)
+{
+	if (!configured)
+		return;
+
+	while (sim_cycles >= next_poll) {
+		next_poll += (uint64_t)interval * 1000 * SIM_CYCLES_PER_US;
+
+		if (usbInterruptIsReady())
+			continue; // NAK
+
+		usbTxLen1 = USBPID_NAK;
+		if (sim_report_hook)
+			sim_report_hook(ep1_data, ep1_len);
+	}
+}
+
+static void setup(unsigned char type, unsigned char request, unsigned short value, unsigned short index, unsigned short length, uchar data[8])
+{
+	usbRequest_t *rq = (void*)data;
+
+	rq->bmRequestType = type;
+	rq->bRequest = request;
+	rq->wValue.word = value;
+	rq->wIndex.word = index;
+	rq->wLength.word = length;
+}
+
+int sim_usb_setReport(unsigned char iface, const unsigned char *data, int len)
+{
+	uchar setup_data[8];
+	uchar chunk[8];
+	int pos, n;
+
+	setup(USBRQ_DIR_HOST_TO_DEVICE | USBRQ_TYPE_CLASS | USBRQ_RCPT_INTERFACE,
+			USBRQ_HID_SET_REPORT, 0x0300, iface, len, setup_data);
+
+	if (usbFunctionSetup(setup_data) != USB_NO_MSG)
+		return -1;
+
+	for (pos = 0; pos < len; pos += 8) {
+		n = len - pos > 8 ? 8 : len - pos;
+		memcpy(chunk, data + pos, n);
+		switch (usbFunctionWrite(chunk, n))
+		{
+			case 0xff: return -1;
+			case 1: return pos + n;
+		}
+	}
+
+	return len;
+}
+
+int sim_usb_getReport(unsigned char iface, unsigned char type, unsigned char *dst, int len)
+{
+	uchar setup_data[8];
+	int n;
+
+	setup(USBRQ_DIR_DEVICE_TO_HOST | USBRQ_TYPE_CLASS | USBRQ_RCPT_INTERFACE,
+			USBRQ_HID_GET_REPORT, type << 8, iface, len, setup_data);
+
+	n = usbFunctionSetup(setup_data);
+	if (n == USB_NO_MSG) {
+#if USB_CFG_IMPLEMENT_FN_READ
+		int pos;
+		uchar chunk;
+
+		for (pos = 0; pos < len; pos += chunk) {
+			chunk = usbFunctionRead(dst + pos, len - pos > 8 ? 8 : len - pos);
+			if (chunk < 8) {
+				pos += chunk;
+				break;
+			}
+		}
+		return pos;
+#else
+		return -1;
+#endif
+	}
+
+	if (n > len)
+		n = len;
+	memcpy(dst, usbMsgPtr, n);
+
+	return n;
+}
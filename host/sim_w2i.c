@@ -0,0 +1,280 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+
+/* Virtual Wiimote accessories. They answer like the real ones with
+ * encryption disabled: Writing sets the register pointer (and registers),
+ * reading returns registers starting at the pointer. The 6 byte report at
+ * 0x00 is encoded from the current inputs when the pointer is set. */
+
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "sim_w2i.h"
+
+uint64_t sim_w2i_latch_time;
+
+static struct {
+	int type;
+	unsigned char regs[256];
+	unsigned char ptr;
+	char addr_next;		// next written byte is the register pointer
+	char in_xfer;		// started, not stopped yet
+	char garbage;		// the current read returns corrupt data
+	uint64_t last_stop;
+
+	unsigned long max_scl_hz;
+	unsigned int turnaround_us;
+	char repeated_start;
+
+	/* Inputs. Buttons are 1 when pressed. */
+	int sx, sy, ax, ay, az, c, z;				// Nunchuk
+	int lx, ly, rx, ry, lt, rt;					// Classic
+	unsigned short buttons;						// Classic (bytes 4 and 5, as in report)
+	int yaw, roll, pitch, yaw_slow, roll_slow, pitch_slow;	// Motion Plus
+} acc = {
+	max_scl_hz: 400000,
+	repeated_start: 1,
+};
+
+/* Classic controller buttons: bit in bytes 4 (high) and 5 (low) */
+static const struct { const char *name; unsigned short mask; } classic_buttons[] = {
+	{ "right", 0x8000 }, { "down", 0x4000 }, { "l", 0x2000 }, { "minus", 0x1000 },
+	{ "home", 0x0800 }, { "plus", 0x0400 }, { "r", 0x0200 },
+	{ "zl", 0x0080 }, { "b", 0x0040 }, { "y", 0x0020 }, { "a", 0x0010 },
+	{ "x", 0x0008 }, { "zr", 0x0004 }, { "left", 0x0002 }, { "up", 0x0001 },
+	{ NULL }
+};
+
+static struct sim_i2c_dev dev;
+
+static void latchReport(void)
+{
+	unsigned char *r = acc.regs;
+	unsigned short b;
+
+	switch (acc.type)
+	{
+		case SIM_W2I_NUNCHUK:
+			r[0] = acc.sx;
+			r[1] = acc.sy;
+			r[2] = acc.ax >> 2;
+			r[3] = acc.ay >> 2;
+			r[4] = acc.az >> 2;
+			r[5] = (acc.az & 3) << 6 | (acc.ay & 3) << 4 | (acc.ax & 3) << 2;
+			r[5] |= (acc.c ? 0 : 0x02) | (acc.z ? 0 : 0x01);
+			break;
+
+		case SIM_W2I_CLASSIC:
+			r[0] = (acc.rx & 0x18) << 3 | (acc.lx & 0x3f);
+			r[1] = (acc.rx & 0x06) << 5 | (acc.ly & 0x3f);
+			r[2] = (acc.rx & 0x01) << 7 | (acc.lt & 0x18) << 2 | (acc.ry & 0x1f);
+			r[3] = (acc.lt & 0x07) << 5 | (acc.rt & 0x1f);
+			b = ~acc.buttons;
+			r[4] = (b >> 8) | 0x01;
+			r[5] = b;
+			break;
+
+		case SIM_W2I_MPLUS:
+			r[0] = acc.yaw;
+			r[1] = acc.roll;
+			r[2] = acc.pitch;
+			r[3] = (acc.yaw >> 6 & 0xfc) | (acc.yaw_slow ? 2 : 0) | (acc.pitch_slow ? 1 : 0);
+			r[4] = (acc.roll >> 6 & 0xfc) | (acc.roll_slow ? 2 : 0);
+			r[5] = (acc.pitch >> 6 & 0xfc) | 0x02;
+			break;
+	}
+
+	sim_w2i_latch_time = sim_cycles;
+}
+
+static char devStart(struct sim_i2c_dev *d, char read)
+{
+	char repeated = acc.in_xfer;
+
+	acc.in_xfer = 1;
+	acc.addr_next = !read;
+	acc.garbage = 0;
+
+	if (read) {
+		if (repeated && !acc.repeated_start)
+			acc.garbage = 1;
+		if (!repeated && sim_cycles - acc.last_stop < (uint64_t)acc.turnaround_us * SIM_CYCLES_PER_US)
+			acc.garbage = 1;
+		if (sim_i2c_sclHz() > acc.max_scl_hz)
+			acc.garbage = 1;
+	}
+
+	return 1;
+}
+
+static char devWrite(struct sim_i2c_dev *d, unsigned char b)
+{
+	if (sim_i2c_sclHz() > acc.max_scl_hz)
+		return 0;
+
+	if (acc.addr_next) {
+		acc.addr_next = 0;
+		acc.ptr = b;
+		if (b < 6)
+			latchReport();
+		return 1;
+	}
+
+	acc.regs[acc.ptr] = b;
+
+	// Motion plus activation: It now answers at the extension address
+	if (acc.type == SIM_W2I_MPLUS && d->addr == 0x53 && acc.ptr == 0xFE && b == 0x04) {
+		d->addr = 0x52;
+		acc.regs[0xFC] = 0xA4;
+		acc.regs[0xFE] = 0x04;
+	}
+	acc.ptr++;
+
+	return 1;
+}
+
+static unsigned char devRead(struct sim_i2c_dev *d)
+{
+	unsigned char b = acc.regs[acc.ptr++];
+
+	return acc.garbage ? 0xff : b;
+}
+
+static void devStop(struct sim_i2c_dev *d)
+{
+	acc.in_xfer = 0;
+	acc.last_stop = sim_cycles;
+}
+
+void sim_w2i_connect(int type)
+{
+	static const unsigned char ids[][6] = {
+		[SIM_W2I_NUNCHUK] = { 0x00, 0x00, 0xA4, 0x20, 0x00, 0x00 },
+		[SIM_W2I_CLASSIC] = { 0x00, 0x00, 0xA4, 0x20, 0x01, 0x01 },
+		[SIM_W2I_MPLUS] = { 0x00, 0x00, 0xA6, 0x20, 0x00, 0x05 },
+	};
+
+	sim_i2c_detach(&dev);
+
+	acc.type = type;
+	acc.in_xfer = 0;
+	memset(acc.regs, 0, sizeof(acc.regs));
+
+	acc.sx = acc.sy = 0x80;
+	acc.ax = acc.ay = 0x200;
+	acc.az = 0x2C0;
+	acc.c = acc.z = 0;
+	acc.lx = acc.ly = 0x20;
+	acc.rx = acc.ry = 0x10;
+	acc.lt = acc.rt = 0;
+	acc.buttons = 0;
+	acc.yaw = acc.roll = acc.pitch = 0x2000;
+	acc.yaw_slow = acc.roll_slow = acc.pitch_slow = 1;
+
+	if (type == SIM_W2I_NONE)
+		return;
+
+	memcpy(acc.regs + 0xFA, ids[type], 6);
+	latchReport();
+
+	memset(&dev, 0, sizeof(dev));
+	dev.addr = type == SIM_W2I_MPLUS ? 0x53 : 0x52;
+	dev.start = devStart;
+	dev.write = devWrite;
+	dev.read = devRead;
+	dev.stop = devStop;
+	sim_i2c_attach(&dev);
+}
+
+int sim_w2i_typeByName(const char *name)
+{
+	if (!strcmp(name, "none")) return SIM_W2I_NONE;
+	if (!strcmp(name, "nunchuk")) return SIM_W2I_NUNCHUK;
+	if (!strcmp(name, "classic")) return SIM_W2I_CLASSIC;
+	if (!strcmp(name, "mplus")) return SIM_W2I_MPLUS;
+	return -1;
+}
+
+int sim_w2i_set(const char *input, int value)
+{
+	static const struct { int type; const char *name; int *ptr; } inputs[] = {
+		{ SIM_W2I_NUNCHUK, "sx", &acc.sx }, { SIM_W2I_NUNCHUK, "sy", &acc.sy },
+		{ SIM_W2I_NUNCHUK, "ax", &acc.ax }, { SIM_W2I_NUNCHUK, "ay", &acc.ay },
+		{ SIM_W2I_NUNCHUK, "az", &acc.az },
+		{ SIM_W2I_NUNCHUK, "c", &acc.c }, { SIM_W2I_NUNCHUK, "z", &acc.z },
+		{ SIM_W2I_CLASSIC, "lx", &acc.lx }, { SIM_W2I_CLASSIC, "ly", &acc.ly },
+		{ SIM_W2I_CLASSIC, "rx", &acc.rx }, { SIM_W2I_CLASSIC, "ry", &acc.ry },
+		{ SIM_W2I_CLASSIC, "lt", &acc.lt }, { SIM_W2I_CLASSIC, "rt", &acc.rt },
+		{ SIM_W2I_MPLUS, "yaw", &acc.yaw }, { SIM_W2I_MPLUS, "roll", &acc.roll },
+		{ SIM_W2I_MPLUS, "pitch", &acc.pitch },
+		{ SIM_W2I_MPLUS, "yaw_slow", &acc.yaw_slow }, { SIM_W2I_MPLUS, "roll_slow", &acc.roll_slow },
+		{ SIM_W2I_MPLUS, "pitch_slow", &acc.pitch_slow },
+	};
+	int i;
+
+	for (i=0; i<sizeof(inputs)/sizeof(inputs[0]); i++) {
+		if (inputs[i].type == acc.type && !strcmp(inputs[i].name, input)) {
+			*inputs[i].ptr = value;
+			return 0;
+		}
+	}
+
+	if (acc.type == SIM_W2I_CLASSIC) {
+		for (i=0; classic_buttons[i].name; i++) {
+			if (!strcmp(classic_buttons[i].name, input)) {
+				if (value)
+					acc.buttons |= classic_buttons[i].mask;
+				else
+					acc.buttons &= ~classic_buttons[i].mask;
+				return 0;
+			}
+		}
+	}
+
+	return -1;
+}
+
+int sim_w2i_calibrate(int reg, int value)
+{
+	unsigned char *blk = acc.regs + (reg & 0xf0);
+	unsigned char sum = 0;
+	int i;
+
+	if ((reg & 0xf0) != 0x20 && (reg & 0xf0) != 0x30)
+		return -1;
+
+	acc.regs[reg] = value;
+
+	if ((reg & 0x0f) < 14) {
+		for (i=0; i<14; i++)
+			sum += blk[i];
+		blk[14] = sum + 0x55;
+		blk[15] = sum + 0xAA;
+	}
+
+	return 0;
+}
+
+void sim_w2i_timing(unsigned long max_scl_hz, unsigned int turnaround_us, char repeated_start)
+{
+	acc.max_scl_hz = max_scl_hz;
+	acc.turnaround_us = turnaround_us;
+	acc.repeated_start = repeated_start;
+}
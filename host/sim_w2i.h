@@ -0,0 +1,50 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _sim_w2i_h__
+#define _sim_w2i_h__
+
+/* Virtual Wiimote accessories on the simulated I2C bus */
+
+#define SIM_W2I_NONE	0
+#define SIM_W2I_NUNCHUK	1
+#define SIM_W2I_CLASSIC	2
+#define SIM_W2I_MPLUS	3
+
+void sim_w2i_connect(int type);
+int sim_w2i_typeByName(const char *name);
+
+/* Change an input (stick axis, button...) of the connected accessory.
+ * Returns -1 if the accessory has no such input. */
+int sim_w2i_set(const char *input, int value);
+
+/* Write to the factory calibration (registers 0x20 and 0x30, 16 bytes
+ * each, blank when connected). The block checksum is updated, except when
+ * writing the checksum itself. Returns -1 for other registers. */
+int sim_w2i_calibrate(int reg, int value);
+
+/* Bus quirks of the accessory. Reads are corrupted (0xff) above max_scl_hz,
+ * when started less than turnaround_us after the previous transaction or
+ * after a repeated start if repeated_start is 0. */
+void sim_w2i_timing(unsigned long max_scl_hz, unsigned int turnaround_us, char repeated_start);
+
+/* Time the accessory last latched its inputs into the report registers */
+extern uint64_t sim_w2i_latch_time;
+
+#endif // _sim_w2i_h__
@@ -0,0 +1,139 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _sim_usbdrv_h__
+#define _sim_usbdrv_h__
+
+/* Stand-in for usbdrv/usbdrv.h in the host build (see sim_usb.c). The
+ * declarations used by the firmware are repeated here with fixed size
+ * types: V-USB's usbWord_t uses 'unsigned', which is 32 bits on the host
+ * and would break the 8 byte setup packet layout. */
+
+#include <stdint.h>
+#include "usbconfig.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#ifndef uchar
+#define uchar   unsigned char
+#endif
+#ifndef schar
+#define schar   signed char
+#endif
+
+#define USB_PUBLIC
+#define usbMsgLen_t uchar
+#define USB_NO_MSG  ((usbMsgLen_t)-1)
+#define usbMsgPtr_t uchar *
+
+#define USB_STRING_DESCRIPTOR_HEADER(stringLength) ((2*(stringLength)+2) | (3<<8))
+
+#define USB_PROP_IS_DYNAMIC     (1u << 14)
+#define USB_PROP_IS_RAM         (1u << 15)
+#define USB_PROP_LENGTH(len)    ((len) & 0x3fff)
+
+#define USB_BUFSIZE     11
+#define USBPID_NAK      0x5a
+
+typedef struct usbTxStatus{
+    volatile uchar   len;
+    uchar   buffer[USB_BUFSIZE];
+}usbTxStatus_t;
+
+extern usbTxStatus_t   usbTxStatus1, usbTxStatus3;
+#define usbTxLen1   usbTxStatus1.len
+#define usbTxBuf1   usbTxStatus1.buffer
+#define usbTxLen3   usbTxStatus3.len
+#define usbTxBuf3   usbTxStatus3.buffer
+
+#define usbInterruptIsReady()   (usbTxLen1 & 0x10)
+#define usbInterruptIsReady3()  (usbTxLen3 & 0x10)
+
+typedef union usbWord{
+    uint16_t    word;
+    uchar       bytes[2];
+}usbWord_t;
+
+typedef struct usbRequest{
+    uchar       bmRequestType;
+    uchar       bRequest;
+    usbWord_t   wValue;
+    usbWord_t   wIndex;
+    usbWord_t   wLength;
+}usbRequest_t;
+
+extern usbMsgPtr_t usbMsgPtr;
+extern uchar usbConfiguration;
+
+void usbInit(void);
+void usbPoll(void);
+usbMsgLen_t usbFunctionSetup(uchar data[8]);
+usbMsgLen_t usbFunctionDescriptor(struct usbRequest *rq);
+void usbSetInterrupt(uchar *data, uchar len);
+void usbSetInterrupt3(uchar *data, uchar len);
+uchar usbFunctionWrite(uchar *data, uchar len);
+uchar usbFunctionRead(uchar *data, uchar len);
+
+#define USBRQ_RCPT_MASK         0x1f
+#define USBRQ_RCPT_DEVICE       0
+#define USBRQ_RCPT_INTERFACE    1
+#define USBRQ_RCPT_ENDPOINT     2
+
+#define USBRQ_TYPE_MASK         0x60
+#define USBRQ_TYPE_STANDARD     (0<<5)
+#define USBRQ_TYPE_CLASS        (1<<5)
+#define USBRQ_TYPE_VENDOR       (2<<5)
+
+#define USBRQ_DIR_MASK              0x80
+#define USBRQ_DIR_HOST_TO_DEVICE    (0<<7)
+#define USBRQ_DIR_DEVICE_TO_HOST    (1<<7)
+
+#define USBRQ_GET_STATUS        0
+#define USBRQ_CLEAR_FEATURE     1
+#define USBRQ_SET_FEATURE       3
+#define USBRQ_SET_ADDRESS       5
+#define USBRQ_GET_DESCRIPTOR    6
+#define USBRQ_SET_DESCRIPTOR    7
+#define USBRQ_GET_CONFIGURATION 8
+#define USBRQ_SET_CONFIGURATION 9
+#define USBRQ_GET_INTERFACE     10
+#define USBRQ_SET_INTERFACE     11
+#define USBRQ_SYNCH_FRAME       12
+
+#define USBDESCR_DEVICE         1
+#define USBDESCR_CONFIG         2
+#define USBDESCR_STRING         3
+#define USBDESCR_INTERFACE      4
+#define USBDESCR_ENDPOINT       5
+#define USBDESCR_HID            0x21
+#define USBDESCR_HID_REPORT     0x22
+#define USBDESCR_HID_PHYS       0x23
+
+#define USBATTR_BUSPOWER        0
+#define USBATTR_SELFPOWER       0x40
+#define USBATTR_REMOTEWAKE      0x20
+
+#define USBRQ_HID_GET_REPORT    0x01
+#define USBRQ_HID_GET_IDLE      0x02
+#define USBRQ_HID_GET_PROTOCOL  0x03
+#define USBRQ_HID_SET_REPORT    0x09
+#define USBRQ_HID_SET_IDLE      0x0a
+#define USBRQ_HID_SET_PROTOCOL  0x0b
+
+#endif
@@ -15,12 +15,21 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/twi.h>
 #include <util/delay.h>
 #include <avr/pgmspace.h>
 #include "usbdrv.h"
 
 #include "i2c.h"
+#include "timer.h"
+#include "stats.h"
+#include "trace.h"
+
+/* A byte takes about 90us at 100kHz. This leaves plenty of
+ * room for clock stretching while keeping a dead bus from
+ * stalling the main loop (and usbPoll) for long. */
+#define I2C_TIMEOUT		TIMER_MS(5)
 
 void i2c_init(int use_int_pullup, unsigned char twbr)
 {
@@ -36,26 +45,23 @@ void i2c_init(int use_int_pullup, unsigned char twbr)
 	TWSR &= ~((1<<TWPS1)|(1<<TWPS0));
 }
 
-#define DEBUGLOW()      PORTC &= 0xFE
-#define DEBUGHIGH()     PORTC |= 0x01
+void i2c_setBitRate(unsigned char twbr)
+{
+	TWBR = twbr;
+}
 
 static int i2cWaitInt(void)
 {
-	unsigned int t=25000;
-
-	DEBUGHIGH();
+	uint16_t start = timer_now();
 
 	while (!(TWCR & (1<<TWINT))) {
-		t--;
-		if (!t) {
-			DEBUGLOW();
+		if ((uint16_t)(timer_now() - start) > I2C_TIMEOUT) {
+			TRACE(TRACE_I2C_TIMEOUT, 0);
+			STATS_INC(i2c_timeouts);
 			return -1;
 		}
-		_delay_us(100);
 	}
 
-	DEBUGLOW();
-
 	return TWSR & 0xF8;
 }
 
@@ -65,10 +71,23 @@ int i2c_transaction(unsigned char addr, int wr_len, unsigned char *wr_data,
 	int ret =0;
 	int res;
 	unsigned char twsr;
+	uint16_t start;
 
 	if (wr_len==0 && rd_len==0)
 		return -1;
 
+	STATS_INC(i2c_xfers);
+	TRACE(TRACE_I2C_START, addr);
+
+	/* Let an interrupt-driven transfer in progress complete first. */
+	start = timer_now();
+	while (i2c_busy()) {
+		if ((uint16_t)(timer_now() - start) > I2C_TIMEOUT) {
+			i2c_abort();
+			break;
+		}
+	}
+
 	if (wr_len != 0)
 	{
 		// Send a start condition
@@ -79,7 +98,6 @@ int i2c_transaction(unsigned char addr, int wr_len, unsigned char *wr_data,
 			return -1;
 		}
 		twsr = res;
-//	DEBUGLOW();
 		if (twsr != TW_START)
 			return 1; // Failed
 
@@ -94,6 +112,7 @@ int i2c_transaction(unsigned char addr, int wr_len, unsigned char *wr_data,
 		/* TWSR can be:
 		 * TW_MT_SLA_ACK, TW_MT_SLA_NACK or TW_MR_ARB_LOST */
 		if (twsr != TW_MT_SLA_ACK) {
+			STATS_INC(i2c_nacks);
 			ret = 2;
 			goto err;
 		}
@@ -109,6 +128,7 @@ int i2c_transaction(unsigned char addr, int wr_len, unsigned char *wr_data,
 			}
 			twsr = res;
 			if (twsr != TW_MT_DATA_ACK) {
+				STATS_INC(i2c_nacks);
 				ret = 3;
 				goto err;
 			}
@@ -143,6 +163,7 @@ int i2c_transaction(unsigned char addr, int wr_len, unsigned char *wr_data,
 		/* TWSR can be:
 		 * TW_MR_SLA_ACK, TW_MR_SLA_NACK or TW_MR_ARB_LOST */
 		if (twsr != TW_MR_SLA_ACK) {
+			STATS_INC(i2c_nacks);
 			ret = 5;
 			goto err;
 		}
@@ -171,6 +192,7 @@ int i2c_transaction(unsigned char addr, int wr_len, unsigned char *wr_data,
 
 	// Stop
 	TWCR = (1<<TWINT)|(1<<TWSTO)|(1<<TWEN);
+	TRACE(TRACE_I2C_STOP, 0);
 
 	return 0;
 
@@ -178,6 +200,7 @@ int i2c_transaction(unsigned char addr, int wr_len, unsigned char *wr_data,
 //	return ret;
 
 err:
+	TRACE(TRACE_I2C_ERROR, ret);
 	switch(twsr)
 	{
 		case TW_MT_ARB_LOST:
@@ -205,3 +228,243 @@ err:
 	return ret;
 }
 
+
+/**** Interrupt driven transfers ****/
+
+static struct i2c_xfer * volatile cur_xfer;
+static unsigned char *x_data;
+static unsigned char x_left;
+static char x_reading;
+
+char i2c_busy(void)
+{
+	return cur_xfer != NULL;
+}
+
+char i2c_submit(struct i2c_xfer *xfer)
+{
+	uint16_t start;
+
+	if (cur_xfer)
+		return -1;
+
+	if (xfer->wr_len) {
+		x_data = xfer->wr_data;
+		x_left = xfer->wr_len;
+		x_reading = 0;
+	} else {
+		x_data = xfer->rd_data;
+		x_left = xfer->rd_len;
+		x_reading = 1;
+	}
+
+	xfer->status = I2C_XFER_PENDING;
+	cur_xfer = xfer;
+	STATS_INC(i2c_xfers);
+	TRACE(TRACE_I2C_START, xfer->addr);
+
+	/* The stop condition from the previous transfer may still be on the way. */
+	start = timer_now();
+	while (TWCR & (1<<TWSTO)) {
+		if ((uint16_t)(timer_now() - start) > I2C_TIMEOUT) {
+			i2c_abort();
+			return -1;
+		}
+	}
+
+	TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN)|(1<<TWIE);
+
+	return 0;
+}
+
+void i2c_abort(void)
+{
+	struct i2c_xfer *xfer = cur_xfer;
+
+	/* Resets the TWI module. Whatever was going on on the bus is lost. */
+	TWCR = 0;
+	TWCR = (1<<TWEN);
+
+	// Only a pending transfer counts as a timeout
+	if (xfer) {
+		STATS_INC(i2c_timeouts);
+		TRACE(TRACE_I2C_TIMEOUT, 1);
+		cur_xfer = NULL;
+		xfer->status = -1;
+	}
+}
+
+/* SCL and SDA are on PC5 and PC4 */
+#define I2C_SCL		(1<<5)
+#define I2C_SDA		(1<<4)
+
+/* Open drain: a low pin is an output, a released one is an input pulled
+ * high (by the internal pull-up too if it was in use). */
+#define PIN_LOW(pin)		do { PORTC &= ~(pin); DDRC |= (pin); } while(0)
+#define PIN_RELEASE(pin)	do { DDRC &= ~(pin); PORTC |= (pin) & pullups; } while(0)
+
+/* 100kHz */
+#define HALF_BIT_US		5
+
+/* Longest a device may stretch the clock during recovery */
+#define SCL_STRETCH_MAX_US	100
+
+/* A device may hold SCL low after it was released (clock stretching).
+ * The half bit only starts once SCL is high. */
+static void waitScl(void)
+{
+	unsigned char us;
+
+	for (us=0; us<SCL_STRETCH_MAX_US && !(PINC & I2C_SCL); us++)
+		_delay_us(1);
+}
+
+char i2c_recoverBus(void)
+{
+	unsigned char pullups;
+	unsigned char pulses;
+
+	if (PINC & I2C_SDA)
+		return 0;
+
+	// Fails the current transfer, if any
+	i2c_abort();
+
+	/* The device holding SDA is waiting for the clock to send the rest
+	 * of a byte. At most 9 pulses (8 bits and the acknowledge) get it
+	 * to release SDA. */
+	pullups = PORTC & (I2C_SCL|I2C_SDA);
+	TWCR = 0;
+
+	for (pulses=0; pulses<9 && !(PINC & I2C_SDA); pulses++) {
+		PIN_LOW(I2C_SCL);
+		_delay_us(HALF_BIT_US);
+		PIN_RELEASE(I2C_SCL);
+		waitScl();
+		_delay_us(HALF_BIT_US);
+	}
+
+	/* A stop condition resets the device state machine */
+	PIN_LOW(I2C_SCL);
+	_delay_us(HALF_BIT_US);
+	PIN_LOW(I2C_SDA);
+	_delay_us(HALF_BIT_US);
+	PIN_RELEASE(I2C_SCL);
+	waitScl();
+	_delay_us(HALF_BIT_US);
+	PIN_RELEASE(I2C_SDA);
+	_delay_us(HALF_BIT_US);
+
+	TWCR = (1<<TWEN);
+
+	STATS_INC(bus_recoveries);
+
+	if (!(PINC & I2C_SDA)) {
+		TRACE(TRACE_I2C_RECOVER, TRACE_I2C_RECOVER_FAILED);
+		return -1;
+	}
+
+	TRACE(TRACE_I2C_RECOVER, pulses);
+
+	return 1;
+}
+
+static void i2c_finish(char status, unsigned char twcr)
+{
+	struct i2c_xfer *xfer = cur_xfer;
+
+	TWCR = twcr;
+
+	cur_xfer = NULL;
+	xfer->status = status;
+	if (status >= 2)
+		STATS_INC(i2c_nacks);
+	if (status)
+		TRACE(TRACE_I2C_ERROR, status);
+	else
+		TRACE(TRACE_I2C_STOP, 0);
+
+	/* May submit a follow-up transfer */
+	if (xfer->complete)
+		xfer->complete(xfer);
+}
+
+#define TWCR_NEXT	((1<<TWINT)|(1<<TWEN)|(1<<TWIE))
+#define TWCR_STOP	((1<<TWINT)|(1<<TWSTO)|(1<<TWEN))
+
+ISR(TWI_vect)
+{
+	struct i2c_xfer *xfer = cur_xfer;
+	unsigned char twsr = TWSR & 0xF8;
+
+	/* Mask the TWI interrupt (TWINT stays set, so the bus is held) and
+	 * allow other interrupts: V-USB must not wait for us. */
+	TWCR = (1<<TWEN);
+	sei();
+
+	if (!xfer)
+		return;
+
+	switch (twsr)
+	{
+		case TW_START:
+		case TW_REP_START:
+			TWDR = (xfer->addr<<1) | x_reading;
+			TWCR = TWCR_NEXT;
+			break;
+
+		case TW_MT_SLA_ACK:
+		case TW_MT_DATA_ACK:
+			if (x_left) {
+				TWDR = *x_data++;
+				x_left--;
+				TWCR = TWCR_NEXT;
+			} else if (xfer->rd_len) {
+				x_data = xfer->rd_data;
+				x_left = xfer->rd_len;
+				x_reading = 1;
+				/* Repeated start */
+				TWCR = TWCR_NEXT | (1<<TWSTA);
+			} else {
+				i2c_finish(0, TWCR_STOP);
+			}
+			break;
+
+		case TW_MT_SLA_NACK:
+			i2c_finish(2, TWCR_STOP);
+			break;
+
+		case TW_MT_DATA_NACK:
+			i2c_finish(3, TWCR_STOP);
+			break;
+
+		case TW_MR_DATA_ACK:
+			*x_data++ = TWDR;
+			x_left--;
+			// fallthrough
+		case TW_MR_SLA_ACK:
+			/* NACK the last byte */
+			if (x_left > 1)
+				TWCR = TWCR_NEXT | (1<<TWEA);
+			else
+				TWCR = TWCR_NEXT;
+			break;
+
+		case TW_MR_DATA_NACK:
+			*x_data = TWDR;
+			i2c_finish(0, TWCR_STOP);
+			break;
+
+		case TW_MR_SLA_NACK:
+			i2c_finish(5, TWCR_STOP);
+			break;
+
+		case TW_MT_ARB_LOST:
+			i2c_finish(1, (1<<TWINT)|(1<<TWEN));
+			break;
+
+		default:
+			i2c_finish(1, TWCR_STOP);
+			break;
+	}
+}
@@ -21,10 +21,45 @@
 #define I2C_FLAG_EXTERNAL_PULLUP	0x0
 void i2c_init(int flags, unsigned char twbr);
 
+/* TWBR value for a given SCL frequency (TWPS = 0). The datasheet
+ * requires at least 10 in master mode, which is 333kHz at 12MHz. */
+#define I2C_TWBR_MIN		10
+#define I2C_TWBR(scl_hz)	((F_CPU / (scl_hz) - 16) / 2 < I2C_TWBR_MIN ? I2C_TWBR_MIN : (F_CPU / (scl_hz) - 16) / 2)
+/* Change the SCL frequency. Do not call during a transfer. */
+void i2c_setBitRate(unsigned char twbr);
+
 #define I2C_FLAG_NO_NACK			0x02 // For reading less bytes 
 int i2c_transaction(unsigned char addr, int wr_len, unsigned char *wr_data, 
 								int rd_len, unsigned char *rd_data, unsigned char flags);
 
+/* Interrupt driven transfers. The write part (if any) is followed by
+ * a repeated start and the read part (if any). status reads
+ * I2C_XFER_PENDING until the transfer ends, and then holds the
+ * same codes as i2c_transaction(). complete, when not NULL, is called
+ * from interrupt context at the end of the transfer and may
+ * submit another transfer. */
+#define I2C_XFER_PENDING	0x7f
+struct i2c_xfer {
+	unsigned char addr;
+	unsigned char wr_len;
+	unsigned char *wr_data;
+	unsigned char rd_len;
+	unsigned char *rd_data;
+	void (*complete)(struct i2c_xfer *xfer);
+	volatile char status;
+};
+
+/* Returns -1 if a transfer is already in progress. */
+char i2c_submit(struct i2c_xfer *xfer);
+char i2c_busy(void);
+/* Reset the TWI and fail the current transfer (for when the bus is stuck) */
+void i2c_abort(void);
+
+/* Free SDA if a device holds it low (accessory unplugged or reset in
+ * the middle of a byte). Call when the bus is idle. Returns 0 if the bus
+ * was fine, 1 if it was recovered and -1 if SDA is still held low. */
+char i2c_recoverBus(void);
+
 #endif // _i2c_h__
 
 
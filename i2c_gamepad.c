@@ -28,102 +28,26 @@
 #include <string.h>
 #include "gamepad.h"
 #include "i2c_gamepad.h"
-#include "i2c.h"
+#include "accessory.h"
+#include "timer.h"
+#include "eeprom.h"
+#include "config.h"
 #include "usbdrv.h"
 #include "usbconfig.h"
 
 #define REPORT_SIZE		8
 
-/* The wiibrew documentation talks about writing to 0x(4)a400xx, reading from 0x(4)a500xx.
- *
- * In binary: 
- * 0xa4..  1010 0100
- * 0xa5..  1010 0101
- *
- * It is clear that A4 and A5 is the first 8 bits of the I2C transaction. The least
- * significant bit is the I2C R/W bit.
- *
- * This translates to a 0x52 7bit address (0xa4>>1)
- *
- * Now the Wii motion plus documentation mentions 0x(4)A6000
- * (http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Wii_Motion_Plus)
- *
- * So we have in binary:
- * 0xa6..  1010 0110
- *
- * The wii motion plus I2C 7 bit address is therfore 0x53.
- *
- * The document then explains the wii motion plus can be made to answer at 0xa4
- * by writing 0x04 to register 0xFE.
- */
-
-#define I2C_STANDARD_ADDRESS	0x52
-#define I2C_W2I_MPLUS_ADDRESS	0x53
-
 // report matching the most recent bytes from the controller
 static unsigned char last_read_controller_bytes[REPORT_SIZE];
 
 // the most recently reported bytes
 static unsigned char last_reported_controller_bytes[REPORT_SIZE];
 
-#define DEBUGLOW()		PORTC &= 0xFE
-#define DEBUGHIGH()		PORTC |= 0x01
-
-#define W2I_REG_REPORT		0x00
-#define W2I_REG_UNKNOWN_F0	0xF0
-#define W2I_REG_UNKNOWN_FB	0xFB
-#define W2I_REG_ID_L		0xFE
-#define W2I_REG_ID_H		0xFF
-
-#define STATE_INIT		0
-#define STATE_READ_DATA	1
-
-static char state = STATE_INIT;
 
 #define FLAG_NO_ANALOG_SLIDERS		1
 #define FLAG_NUNCHUK_Z_DISABLED	2
 static unsigned char current_flags = FLAG_NO_ANALOG_SLIDERS;
 
-// Based on reading 0xFE and 0xFF. This might be wrong...
-#define ID_NUNCHUK	0x0000
-#define ID_CLASSIC	0x0101
-#define ID_MPLUS	0x0405
-
-static unsigned short peripheral_id = ID_NUNCHUK;
-
-static char w2i_reg_writeByte(unsigned char i2c_addr, unsigned char reg_addr, unsigned char value)
-{
-	unsigned char tmpbuf[2];
-	char res;
-
-	tmpbuf[0] = reg_addr;
-	tmpbuf[1] = value;
-
-	res = i2c_transaction(i2c_addr, 2, tmpbuf, 0, NULL, 0);
-	_delay_us(400);
-
-	return res;
-}
-
-static char w2i_reg_readBlock(unsigned char reg_addr, unsigned char *dst, int len)
-{
-	char res;
-
-	res = i2c_transaction(I2C_STANDARD_ADDRESS, 1, &reg_addr, 0, NULL, 0);
-	if (res)
-		return res;
-
-	_delay_us(400);
-
-	res = i2c_transaction(I2C_STANDARD_ADDRESS, 0, NULL, len, dst, 0);
-	if (res)
-		return res;
-
-	_delay_us(400);
-
-	return 0;
-}
-
 static void setLastValues(unsigned char x, unsigned char y, unsigned short rx, unsigned short ry, unsigned short rz, unsigned char btns_l, unsigned char btns_h)
 {
 	last_read_controller_bytes[0] = x;
@@ -138,248 +62,155 @@ static void setLastValues(unsigned char x, unsigned char y, unsigned short rx, u
 	last_read_controller_bytes[7] = btns_h;
 }
 
-static void i2cGamepad_Update(void)
+/* Not used by any other gesture. C+Z alone is held at connection to
+ * disable the Z axis, and HOME alone toggles the L slider. */
+#define CHORD_STICK_DOWN	0x20
+
+char i2cGamepad_profileChord(const struct accessory_sample *acc)
 {
-	unsigned char buf[16];
-	char res;
-	unsigned char x=0x80,y=0x80;
-	unsigned char btns_l=0, btns_h=0;
-	unsigned short rx=0x200,ry=0x200,rz=0x200;
-	static char mplus_cal = 0;
-	static char device_changed = 0;
-	static int home_count = 0;
-
-	switch (state)
+	switch (acc->id)
 	{
+		case ACCESSORY_NUNCHUK:
+			return (acc->buttons & (ACC_BTN_C|ACC_BTN_Z)) == (ACC_BTN_C|ACC_BTN_Z) && acc->ly < CHORD_STICK_DOWN;
 
-		case STATE_INIT:
-			mplus_cal =0;
+		case ACCESSORY_CLASSIC:
+			return (acc->buttons & (ACC_BTN_SELECT|ACC_BTN_START)) == (ACC_BTN_SELECT|ACC_BTN_START);
+	}
 
-			// For now, we consider everything answering at this address to be the motion plus.
-			// This switches the mplus to the standard address.
-			res = w2i_reg_writeByte(I2C_W2I_MPLUS_ADDRESS, 0xFE, 0x04);
-			// ignore failure
+	return 0;
+}
 
-			//
-			// Init sequence from:
-			//
-			// http://wiibrew.org/wiki/Wiimote/Extension_Controllers
-			//
-			res = w2i_reg_writeByte(I2C_STANDARD_ADDRESS, W2I_REG_UNKNOWN_F0, 0x55);
-			if (res)
-				return;
+static int home_count = 0;
+static uint16_t home_time;
 
-			res = w2i_reg_writeByte(I2C_STANDARD_ADDRESS, W2I_REG_UNKNOWN_FB, 0x00);
-			if (res)
-				return;
+static char mplus_cal = 0;
 
-			res = w2i_reg_readBlock(W2I_REG_ID_L, buf, 2);
-			if (res)
-				return;
+/* Rotation rate to a 10 bit axis, zeroed on the rate
+ * seen while the Motion Plus was held still at connection. */
+static unsigned short gyroToAxis(unsigned short raw, short cal)
+{
+	short v;
 
-			peripheral_id = buf[1] | buf[0]<<8;
+	// convert to signed value
+	v = (raw << 2) ^ 0x8000;
 
-			state = STATE_READ_DATA;
-			device_changed = 1;
-			_delay_ms(1000);
-			break;
+	v -= cal;
 
-			// fallthrough
-		case STATE_READ_DATA:
-			res = w2i_reg_readBlock(W2I_REG_REPORT, buf, 6);
-			if (res) {
-				state = STATE_INIT;
-				return;
-			}
+	// We have a 14 bit value to fit in a 10 bit report.
+	//
+	// A shift of 6 keeps the high order bits (detects stronger motions)
+	// A shift of 0 keeps the low order bits (detects very small motions)
+	v >>= 5;
 
-			switch (peripheral_id)
-			{
-				default:
-				case ID_NUNCHUK:
-					// Source: http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Nunchuck
-					//
-					//     7   6    5   4    3   2     1   0
-					// 0   SX<7:0>
-					// 1   SY<7:0>
-					// 2   AX<9:2>
-					// 3   AY<9:2>
-					// 4   AZ<9:2>
-					// 5   AZ<1:0>  AY<1:0>  AX<1:0>   BC  BZ
-					//
-					x = buf[0];
-					y = buf[1] ^ 0xff;
-					rx = ((buf[5] & 0x0C) >> 2)	| (buf[2] << 2);
-					ry = ((buf[5] & 0x30) >> 4)	| (buf[3] << 2);
-					rz = ((buf[5] & 0xC0) >> 6)	| (buf[4] << 2);
-
-					if (!(buf[5]&0x01)) btns_l |= 0x01;
-					if (!(buf[5]&0x02)) btns_l |= 0x02;
-
-					if (device_changed) {
-						device_changed = 0;
-
-						// Holding both buttons at startup/connection
-						// disables the Z axis (The gravity offset makes
-						// it tricky to map buttons in many emulators)
-						if ((btns_l & 0x03) == 0x03) { // HOME
-							current_flags |= FLAG_NUNCHUK_Z_DISABLED;
-						} else {
-							current_flags &= ~FLAG_NUNCHUK_Z_DISABLED;
-						}
-					}
+	if (v > 0x1FF)
+		v = 0x1ff;
+	else if (v < -0x1FF)
+		v = -0x1ff;
 
-					if (current_flags & FLAG_NUNCHUK_Z_DISABLED) {
-						rz = 0x200;
-					}
+	return v ^ 0x200;
+}
 
-					break;
-
-				case ID_CLASSIC:
-					// Source: http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Classic_Controller
-					//
-					//     7        6     5    4    3     2     1     0
-					// 0   RX<4:3>        LX<5:0>
-					// 1   RX<2:1>        LY<5:0>
-					// 2   RX<0>    LT<4:3>    RY<4:0>
-					// 3   LT<2:0>             RT<4:0>
-					// 4   BDR      BDD   BLT  B-   BH    B+    BRT   1
-					// 5   BZL      BB    BY   BA   BX    BZR   BDL   BDU
-					//
-					x = buf[0] << 2;
-					y = (buf[1] << 2) ^ 0xFF;
-					rx = ((buf[2]>>7) | ((buf[1]&0xC0)>>5) | ((buf[0]&0xC0)>>3)) << 5;
-					ry = ((buf[2]&0x1f) << 5) ^ 0x3FF;
-					rz = ((buf[3]>>5) | ((buf[2] & 0x60) >> 2) ) << 5;
-					rz ^= 0xffff;
-
-					// The fist 12 USB button IDs follow the assignments of my Gamecube to USB adapter project.
-					if (!(buf[4] & 0x04)) btns_l |= 0x01; // +/Start
-					if (!(buf[5] & 0x20)) btns_l |= 0x02; // Y
-					if (!(buf[5] & 0x08)) btns_l |= 0x04; // X
-					if (!(buf[5] & 0x40)) btns_l |= 0x08; // B
-					if (!(buf[5] & 0x10)) btns_l |= 0x10; // A
-					if (!(buf[4] & 0x20)) btns_l |= 0x20; // L trig
-					if (!(buf[4] & 0x02)) btns_l |= 0x40; // R trig
-					if (!(buf[5] & 0x04)) btns_l |= 0x80; // Zr
-					if (!(buf[5] & 0x01)) btns_h |= 0x01; // UP
-					if (!(buf[4] & 0x40)) btns_h |= 0x02; // DOWN
-					if (!(buf[4] & 0x80)) btns_h |= 0x04; // RIGHT
-					if (!(buf[5] & 0x02)) btns_h |= 0x08; // LEFT
-
-					if (!(buf[5] & 0x80)) btns_h |= 0x10; // Zl
-					if (!(buf[4] & 0x10)) btns_h |= 0x20; // SELECT
-					if (!(buf[4] & 0x08)) btns_h |= 0x40; // HOME
-
-					if (device_changed) {
-						device_changed = 0;
-
-						// Holding the HOME button enables the troublesome L slider
-						if (btns_h & 0x40) { // HOME
-							current_flags &= ~FLAG_NO_ANALOG_SLIDERS;
-						} else {
-							current_flags |= FLAG_NO_ANALOG_SLIDERS;
-						}
-					}
-#define HOME_HOLD_COUNT	180
-					// Holding HOME for 3 seconds toggles the enabled state of the L slider
-					if (btns_h & 0x40) {
-						if (home_count < HOME_HOLD_COUNT) { // approx. 3 sec.
-							home_count++;
-						} else if (home_count==HOME_HOLD_COUNT) {
-							current_flags ^= FLAG_NO_ANALOG_SLIDERS;
-							home_count++;
-						}
-					} else {
-						home_count=0;
-					}
+static char i2cGamepad_Poll(void)
+{
+	struct accessory_sample *acc = &g_accessory;
+	static short cal_yaw, cal_roll, cal_pitch;
+	unsigned char x = 0x80, y = 0x80;
+	unsigned short rx = 0x200, ry = 0x200, rz = 0x200;
 
-					if (current_flags & FLAG_NO_ANALOG_SLIDERS) {
-						rz = 0x200;
-					}
+	if (!accessory_poll())
+		return 0;
+
+	switch (acc->id)
+	{
+		default:
+		case ACCESSORY_NUNCHUK:
+			x = acc->lx;
+			y = acc->ly ^ 0xff;
+			rx = acc->accel[0];
+			ry = acc->accel[1];
+			rz = acc->accel[2];
+
+			if (acc->new_device) {
+				// Holding both buttons at startup/connection
+				// disables the Z axis (The gravity offset makes
+				// it tricky to map buttons in many emulators)
+				if ((acc->buttons & (ACC_BTN_C|ACC_BTN_Z)) == (ACC_BTN_C|ACC_BTN_Z)) {
+					current_flags |= FLAG_NUNCHUK_Z_DISABLED;
+				} else {
+					current_flags &= ~FLAG_NUNCHUK_Z_DISABLED;
+				}
+			}
+
+			if (current_flags & FLAG_NUNCHUK_Z_DISABLED) {
+				rz = 0x200;
+			}
 
-					break;
-
-				case ID_MPLUS:
-					{
-						static short cal_rrx, cal_rry, cal_rrz;
-						short rrx, rry, rrz;
-
-#define SAT_10BIT_SIGNED(v)	do { if ((v) > 0x1FF)  (v) = 0x1ff; else if ((v) < -0x1FF) (v)= -0x1ff; } while(0)
-
-						rrx = (buf[0] | ((buf[3]&0xFC)<<6)) << 2;
-						rry = (buf[1] | ((buf[4]&0xFC)<<6)) << 2;
-						rrz = (buf[2] | ((buf[5]&0xFC)<<6)) << 2;
-
-						// convert to signed value
-						rrx ^= 0x8000;
-						rry ^= 0x8000;
-						rrz ^= 0x8000;
-
-						// zero values on origin
-						if (mplus_cal < 10) {
-							mplus_cal++;
-							cal_rrx = rrx;
-							cal_rry = rry;
-							cal_rrz = rrz;
-						}
-
-						rrx -= cal_rrx;
-						rry -= cal_rry;
-						rrz -= cal_rrz;
-
-						// We have a 14 bit value to fit in a 10 bit report.
-						//
-						// A shift of 6 keeps the high order bits (detects stronger motions)
-						// A shift of 0 keeps the low order bits (detects very small motions)
-						rrx >>= 5;
-						rry >>= 5;
-						rrz >>= 5;
-
-						SAT_10BIT_SIGNED(rrx);
-						SAT_10BIT_SIGNED(rry);
-						SAT_10BIT_SIGNED(rrz);
-
-						rx = rrx ^ 0x200;
-						ry = rry ^ 0x200;
-						rz = rrz ^ 0x200;
-
-						if (!(buf[3] & 0x02)) btns_l |= 0x01;
-						if (!(buf[3] & 0x01)) btns_l |= 0x02;
-						if (!(buf[4] & 0x02)) btns_l |= 0x04;
-						if ((buf[4] & 0x01)) btns_l |= 0x08; // extension connected
+			break;
+
+		case ACCESSORY_CLASSIC:
+			x = acc->lx << 2;
+			y = (acc->ly << 2) ^ 0xFF;
+			rx = acc->rx << 5;
+			ry = (acc->ry << 5) ^ 0x3FF;
+			rz = (acc->lt << 5) ^ 0xffff;
+
+			if (acc->new_device) {
+				// Holding the HOME button enables the troublesome L slider
+				if (acc->buttons & ACC_BTN_HOME) {
+					current_flags &= ~FLAG_NO_ANALOG_SLIDERS;
+				} else {
+					current_flags |= FLAG_NO_ANALOG_SLIDERS;
+				}
+			}
+#define HOME_HOLD_COUNT	30 // in 100ms units, independent from the poll rate
+
+			// Holding HOME for 3 seconds toggles the enabled state of the L slider
+			if (acc->buttons & ACC_BTN_HOME) {
+				if (!home_count) {
+					home_count = 1;
+					home_time = timer_now();
+				} else if ((uint16_t)(timer_now() - home_time) >= TIMER_MS(100)) {
+					home_time += TIMER_MS(100);
+					if (home_count < HOME_HOLD_COUNT) {
+						home_count++;
+					} else if (home_count==HOME_HOLD_COUNT) {
+						current_flags ^= FLAG_NO_ANALOG_SLIDERS;
+						home_count++;
 					}
+				}
+			} else {
+				home_count=0;
+			}
 
-					break;
-			} // switch peripheral_id
+			if (current_flags & FLAG_NO_ANALOG_SLIDERS) {
+				rz = 0x200;
+			}
 
-			break; // STATE
-	}
+			break;
 
-	setLastValues(x,y,rx,ry,rz,btns_l,btns_h);
-}
+		case ACCESSORY_MPLUS:
+			if (acc->new_device)
+				mplus_cal = 0;
 
-static void i2cGamepad_Init(void)
-{
-	//
-	// TWPS = 0
-	// CPU FREQ = 12000000
-	// TARGET SCL FREQ = 400000
-	//
-	//                   CPU FREQ
-	//             --------------------
-	// SCL freq =  16 + 2*TWBR * 4^TWPS
-	//
-	// TWBR = (((12000000 / 400000) - 16) / 1) / 2 = 7
-	//
-	//i2c_init(I2C_FLAG_EXTERNAL_PULLUP, 15);
+			// zero values on origin (the rate after 10 samples)
+			if (mplus_cal < 10) {
+				mplus_cal++;
+				cal_yaw = (acc->gyro[ACC_GYRO_YAW] << 2) ^ 0x8000;
+				cal_roll = (acc->gyro[ACC_GYRO_ROLL] << 2) ^ 0x8000;
+				cal_pitch = (acc->gyro[ACC_GYRO_PITCH] << 2) ^ 0x8000;
+			}
+
+			rx = gyroToAxis(acc->gyro[ACC_GYRO_YAW], cal_yaw);
+			ry = gyroToAxis(acc->gyro[ACC_GYRO_ROLL], cal_roll);
+			rz = gyroToAxis(acc->gyro[ACC_GYRO_PITCH], cal_pitch);
+			break;
+	}
 
-	// In fact, 100khz is stable.
-	i2c_init(I2C_FLAG_EXTERNAL_PULLUP, 52);
+	config_profileChord(i2cGamepad_profileChord(acc));
 
-	i2cGamepad_Update();
+	setLastValues(x, y, rx, ry, rz, acc->buttons, acc->buttons >> 8);
 
-	DDRC |= 0x01;
-	DEBUGLOW();
+	return 1;
 }
 
 static char i2cGamepad_Changed(void)
@@ -501,8 +332,9 @@ Gamepad i2cGamepad_Gamepad = {
 	reportDescriptorSize:	sizeof(usbHidReportDescriptor_5axes_16btns),
 	deviceDescriptor:	usbDescrDevice,
 	deviceDescriptorSize:	sizeof(usbDescrDevice),
-	init: 			i2cGamepad_Init,
-	update: 		i2cGamepad_Update,
+	init: 			accessory_init,
+	update: 		accessory_update,
+	poll:			i2cGamepad_Poll,
 	changed:		i2cGamepad_Changed,
 	buildReport:		i2cGamepad_BuildReport
 };
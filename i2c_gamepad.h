@@ -1,4 +1,10 @@
 #include "gamepad.h"
+#include "accessory.h"
 
 Gamepad *i2cGamepad_GetGamepad(void);
 
+/* True while the profile switching chord is held: C+Z with the stick
+ * pushed down on a Nunchuk, - and + on a Classic controller. Pass it
+ * to config_profileChord() with each sample. */
+char i2cGamepad_profileChord(const struct accessory_sample *acc);
+
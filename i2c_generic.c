@@ -29,34 +29,13 @@
 #include "gamepad.h"
 #include "i2c_gamepad.h"
 #include "i2c.h"
+#include "w2i.h"
+#include "timer.h"
 #include "usbdrv.h"
 #include "usbconfig.h"
 #include "eeprom.h"
 #include "i2c_raw.h"
 
-/* The wiibrew documentation talks about writing to 0x(4)a400xx, reading from 0x(4)a500xx.
- *
- * In binary:
- * 0xa4..  1010 0100
- * 0xa5..  1010 0101
- *
- * It is clear that A4 and A5 is the first 8 bits of the I2C transaction. The least
- * significant bit is the I2C R/W bit.
- *
- * This translates to a 0x52 7bit address (0xa4>>1)
- *
- * Now the Wii motion plus documentation mentions 0x(4)A6000
- * (http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Wii_Motion_Plus)
- *
- * So we have in binary:
- * 0xa6..  1010 0110
- *
- * The wii motion plus I2C 7 bit address is therfore 0x53.
- *
- * The document then explains the wii motion plus can be made to answer at 0xa4
- * by writing 0x04 to register 0xFE.
- */
-
 static const char dummy_gamepad_reportdesc[] PROGMEM = {
 	0x06, 0x00, 0xff,	// USAGE_PAGE (Generic Desktop)
 	0x09, 0x01,			// USAGE (Vendor Usage 1)
@@ -72,65 +51,76 @@ static const char dummy_gamepad_reportdesc[] PROGMEM = {
 
 static char g_address = 0xFF;
 
-#define DEBUGLOW()		PORTC &= 0xFE
-#define DEBUGHIGH()		PORTC |= 0x01
-
-#define W2I_REG_REPORT		0x00
-#define W2I_REG_UNKNOWN_F0	0xF0
-#define W2I_REG_UNKNOWN_FB	0xFB
-#define W2I_REG_ID_L		0xFE
-#define W2I_REG_ID_H		0xFF
-
-static char w2i_reg_writeBlock(unsigned char i2c_addr, unsigned char reg_addr, const unsigned char *data, int len)
-{
-	unsigned char tmpbuf[1 + len];
-	char res;
+//
+// resultBuf[0] : Result type
+//   0x00: None
+//   0x01: Success
+//   0x02: Read data
+//   0xFF: Error
+//
+static unsigned char resultBuf[7];
 
-	tmpbuf[0] = reg_addr;
-	memcpy(tmpbuf + 1, data, len);
+static unsigned char xfer_buf[7];
+static unsigned char xfer_cmd;
 
-	res = i2c_transaction(i2c_addr, len + 1, tmpbuf, 0, NULL, 0);
-	_delay_us(400);
+/* Set when the register pointer is written. The read is started
+ * by rawi2c_poll() once the accessory had time to get ready. */
+static volatile char read_pending;
+static uint16_t pointer_time;
 
-	return res;
-}
+static void rawi2c_readDone(struct i2c_xfer *xfer);
+static void rawi2c_pointerDone(struct i2c_xfer *xfer);
 
-static char w2i_reg_readBlock(unsigned char i2c_addr, unsigned char reg_addr, unsigned char *dst, int len)
-{
-	char res;
+static struct i2c_xfer pointer_xfer = {
+	wr_data:	xfer_buf,
+	complete:	rawi2c_pointerDone,
+};
 
-	res = i2c_transaction(i2c_addr, 1, &reg_addr, 0, NULL, 0);
-	if (res)
-		return res;
+static struct i2c_xfer read_xfer = {
+	rd_data:	resultBuf + 1,
+	complete:	rawi2c_readDone,
+};
 
-	_delay_us(400);
+static struct i2c_xfer write_xfer = {
+	wr_data:	xfer_buf,
+	complete:	rawi2c_readDone,
+};
 
-	res = i2c_transaction(i2c_addr, 0, NULL, len, dst, 0);
-	if (res)
-		return res;
+/* Called from interrupt context when the final transfer of a command ends */
+static void rawi2c_readDone(struct i2c_xfer *xfer)
+{
+	if (xfer->status) {
+		resultBuf[0] = I2C_RAW_TIMEOUT;
+	} else {
+		resultBuf[0] = xfer_cmd;
+	}
+}
 
-	_delay_us(400);
+/* Register pointer written. The register(s) are read after the turnaround delay. */
+static void rawi2c_pointerDone(struct i2c_xfer *xfer)
+{
+	if (xfer->status) {
+		resultBuf[0] = I2C_RAW_TIMEOUT;
+		return;
+	}
 
-	return 0;
+	read_xfer.addr = xfer->addr;
+	pointer_time = timer_now();
+	read_pending = 1;
 }
 
-//
-// resultBuf[0] : Result type
-//   0x00: None
-//   0x01: Success
-//   0x02: Read data
-//   0xFF: Error
-//
-static unsigned char resultBuf[7];
-
 static char rawi2c_setFeatureReport(unsigned char *data, unsigned char len)
 {
-	int res;
-
 	if (len != 7) {
 		return -1;
 	}
 
+	// The previous command must complete first.
+	if (i2c_busy() || read_pending) {
+		resultBuf[0] = I2C_RAW_BUSY;
+		return 1;
+	}
+
 	memset(resultBuf, 0, sizeof(resultBuf));
 
 	switch (data[0])
@@ -150,13 +140,12 @@ static char rawi2c_setFeatureReport(unsigned char *data, unsigned char len)
 		case I2C_RAW_WRITE_REG7:
 			// data[1] REG
 			// data[2-6] DATA (length based on command)
-			res = w2i_reg_writeBlock(g_address, data[1], data + 2, data[0] - I2C_RAW_WRITE_REG1 + 1);
-			if (res) {
-				resultBuf[0] = I2C_RAW_TIMEOUT;
-			} else {
-				resultBuf[0] = I2C_RAW_OK;
-			}
-
+			memcpy(xfer_buf, data + 1, 6);
+			xfer_cmd = I2C_RAW_OK;
+			write_xfer.addr = g_address;
+			write_xfer.wr_len = data[0] - I2C_RAW_WRITE_REG1 + 2;
+			resultBuf[0] = I2C_RAW_BUSY;
+			i2c_submit(&write_xfer);
 			break;
 
 		case I2C_RAW_READ_REG1:
@@ -167,12 +156,13 @@ static char rawi2c_setFeatureReport(unsigned char *data, unsigned char len)
 		case I2C_RAW_READ_REG6:
 		case I2C_RAW_READ_REG7:
 			// data[1] REG
-			res = w2i_reg_readBlock(g_address, data[1], resultBuf + 1, data[0] - I2C_RAW_READ_REG1 + 1);
-			if (res) {
-				resultBuf[0] = I2C_RAW_TIMEOUT;
-			} else {
-				resultBuf[0] = data[0];
-			}
+			xfer_buf[0] = data[1];
+			xfer_cmd = data[0];
+			pointer_xfer.addr = g_address;
+			pointer_xfer.wr_len = 1;
+			read_xfer.rd_len = data[0] - I2C_RAW_READ_REG1 + 1;
+			resultBuf[0] = I2C_RAW_BUSY;
+			i2c_submit(&pointer_xfer);
 			break;
 
 		case I2C_RAW_ECHO_RQ:
@@ -195,6 +185,17 @@ static void rawi2c_update(void)
 {
 }
 
+static char rawi2c_poll(void)
+{
+	if (read_pending && (uint16_t)(timer_now() - pointer_time) >= TIMER_US(W2I_TURNAROUND_SAFE_US)) {
+		read_pending = 0;
+		i2c_submit(&read_xfer);
+	}
+
+	// There are no input reports
+	return 0;
+}
+
 static void rawi2c_init(void)
 {
 	//
@@ -253,6 +254,7 @@ static Gamepad dummyGamepad = {
 	deviceDescriptorSize:	sizeof(rawi2c_device_descriptor),
 	init: 			rawi2c_init,
 	update: 		rawi2c_update,
+	poll:			rawi2c_poll,
 	changed:		rawi2c_changed,
 	buildReport:	rawi2c_buildreport,
 	setFeatureReport:	rawi2c_setFeatureReport,
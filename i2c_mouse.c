@@ -28,36 +28,12 @@
 #include <string.h>
 #include "gamepad.h"
 #include "i2c_gamepad.h"
-#include "i2c.h"
+#include "accessory.h"
 #include "usbdrv.h"
 #include "usbconfig.h"
 #include "eeprom.h"
-
-/* The wiibrew documentation talks about writing to 0x(4)a400xx, reading from 0x(4)a500xx.
- *
- * In binary:
- * 0xa4..  1010 0100
- * 0xa5..  1010 0101
- *
- * It is clear that A4 and A5 is the first 8 bits of the I2C transaction. The least
- * significant bit is the I2C R/W bit.
- *
- * This translates to a 0x52 7bit address (0xa4>>1)
- *
- * Now the Wii motion plus documentation mentions 0x(4)A6000
- * (http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Wii_Motion_Plus)
- *
- * So we have in binary:
- * 0xa6..  1010 0110
- *
- * The wii motion plus I2C 7 bit address is therfore 0x53.
- *
- * The document then explains the wii motion plus can be made to answer at 0xa4
- * by writing 0x04 to register 0xFE.
- */
-
-#define I2C_STANDARD_ADDRESS	0x52
-#define I2C_W2I_MPLUS_ADDRESS	0x53
+#include "config.h"
+#include "timer.h"
 
 #define REPORT_SIZE		4
 /*
@@ -127,70 +103,56 @@ static unsigned char last_reported_controller_bytes[REPORT_SIZE];
 
 static char g_active = 0;
 
-#define DEBUGLOW()		PORTC &= 0xFE
-#define DEBUGHIGH()		PORTC |= 0x01
-
-#define W2I_REG_REPORT		0x00
-#define W2I_REG_UNKNOWN_F0	0xF0
-#define W2I_REG_UNKNOWN_FB	0xFB
-#define W2I_REG_ID_L		0xFE
-#define W2I_REG_ID_H		0xFF
-
-#define STATE_INIT		0
-#define STATE_READ_DATA	1
+/* Movement not yet sent to the host. Sampling continues while a
+ * report is pending, so it accumulates until the report is built. */
+static int pending_x, pending_y, pending_w;
 
-static char state = STATE_INIT;
 
-// Based on reading 0xFE and 0xFF. This might be wrong...
-#define ID_NUNCHUK	0x0000
-#define ID_CLASSIC	0x0101
+#define MOUSE_DEADZONE	g_eeprom_data.cfg.mouse_deadzone
+#define SCR_NCK_THRES	g_eeprom_data.cfg.scroll_nunchuck_threshold
+#define SCR_NCK_C_THRES	g_eeprom_data.cfg.scroll_nunchuck_c_threshold
+#define SCR_RJOY_THRES	8
 
-static unsigned short peripheral_id = ID_NUNCHUK;
+/* Pointer speed and continuous scrolling are defined per MOUSE_PERIOD,
+ * the 60Hz sampling rate used before the rate became configurable. */
+#define MOUSE_PERIOD	(TIMER_HZ / 60)
 
-static char w2i_reg_writeByte(unsigned char i2c_addr, unsigned char reg_addr, unsigned char value)
+/* Scale a movement of v per MOUSE_PERIOD (divided by div) to the time
+ * since the previous sample, rounded. The remainder is kept for the next
+ * sample, so slow movements are not lost at high sampling rates. */
+static int scaleToPeriod(int v, long *rem, uint16_t dt, unsigned char div)
 {
-	unsigned char tmpbuf[2];
-	char res;
+	long total, d = (long)MOUSE_PERIOD * div;
+	int out;
 
-	tmpbuf[0] = reg_addr;
-	tmpbuf[1] = value;
+	if (!v) {
+		*rem = 0;
+		return 0;
+	}
 
-	res = i2c_transaction(i2c_addr, 2, tmpbuf, 0, NULL, 0);
-	_delay_us(400);
+	total = *rem + (long)v * dt;
+	out = (total + (total < 0 ? -d/2 : d/2)) / d;
+	*rem = total - (long)out * d;
 
-	return res;
+	return out;
 }
 
-static char w2i_reg_readBlock(unsigned char reg_addr, unsigned char *dst, int len)
+static int clamp127(int v)
 {
-	char res;
-
-	res = i2c_transaction(I2C_STANDARD_ADDRESS, 1, &reg_addr, 0, NULL, 0);
-	if (res)
-		return res;
-
-	_delay_us(400);
-
-	res = i2c_transaction(I2C_STANDARD_ADDRESS, 0, NULL, len, dst, 0);
-	if (res)
-		return res;
-
-	_delay_us(400);
-
-	return 0;
+	if (v < -127)
+		return -127;
+	if (v > 127)
+		return 127;
+	return v;
 }
 
-#define MOUSE_DEADZONE	g_eeprom_data.cfg.mouse_deadzone
-#define SCR_NCK_THRES	g_eeprom_data.cfg.scroll_nunchuck_threshold
-#define SCR_NCK_C_THRES	g_eeprom_data.cfg.scroll_nunchuck_c_threshold
-#define SCR_RJOY_THRES	8
-
-static void setLastValues(unsigned char x, unsigned char y, unsigned short rx, unsigned short ry, unsigned short rz, unsigned char btns, unsigned char orig_x, unsigned char orig_y)
+static void setLastValues(unsigned short peripheral_id, unsigned char x, unsigned char y, unsigned short rx, unsigned short ry, unsigned char btns, unsigned char orig_x, unsigned char orig_y, uint16_t dt)
 {
 	int X,Y,XO,YO;;
 	int W = 0;
 	static int w_active;
-	static unsigned char wvalue = 0;
+	int wvalue = 0;
+	static long rem_x, rem_y, rem_w;
 
 	X = x - 0x80;
 	Y = y - 0x80;
@@ -215,7 +177,7 @@ static void setLastValues(unsigned char x, unsigned char y, unsigned short rx, u
 		Y = 0;
 	}
 
-	if (peripheral_id == ID_NUNCHUK)
+	if (peripheral_id == ACCESSORY_NUNCHUK)
 	{
 		if (g_eeprom_data.cfg.scroll_nunchuck_c)
 		{ // scroll by pressing C while moving
@@ -248,7 +210,7 @@ static void setLastValues(unsigned char x, unsigned char y, unsigned short rx, u
 				} else {
 					W = 0;
 				}
-				wvalue = W;
+				wvalue = scaleToPeriod(W, &rem_w, dt, 1);
 			} else {
 				wvalue = 0;
 			}
@@ -284,7 +246,7 @@ static void setLastValues(unsigned char x, unsigned char y, unsigned short rx, u
 		}
 	}
 
-	if (peripheral_id == ID_CLASSIC)
+	if (peripheral_id == ACCESSORY_CLASSIC)
 	{
 		W = ry - 0x10;
 
@@ -312,7 +274,7 @@ static void setLastValues(unsigned char x, unsigned char y, unsigned short rx, u
 			w_active = 0;
 		}
 
-		wvalue = W;
+		wvalue = scaleToPeriod(W, &rem_w, dt, 1);
 	}
 
 	if (X || Y || W || (btns & 0xf0)) {
@@ -321,189 +283,94 @@ static void setLastValues(unsigned char x, unsigned char y, unsigned short rx, u
 		g_active = 0;
 	}
 
-	X /= g_eeprom_data.cfg.mouse_divisor;
-	Y /= g_eeprom_data.cfg.mouse_divisor;
-
-	if (btns & 0x10) Y = -1;
-	if (btns & 0x20) Y = 1;
-	if (btns & 0x40) X = 1;
-	if (btns & 0x80) X = -1;
+	// The d-pad moves by 1 per period
+	if (btns & 0x10) Y = -g_eeprom_data.cfg.mouse_divisor;
+	if (btns & 0x20) Y = g_eeprom_data.cfg.mouse_divisor;
+	if (btns & 0x40) X = g_eeprom_data.cfg.mouse_divisor;
+	if (btns & 0x80) X = -g_eeprom_data.cfg.mouse_divisor;
 
-	if (X < -127)
-		X = -127;
-	if (X > 127)
-		X = 127;
-	if (Y < -127)
-		Y = -127;
-	if (Y > 127)
-		Y = 127;
+	pending_x = clamp127(pending_x + scaleToPeriod(X, &rem_x, dt, g_eeprom_data.cfg.mouse_divisor));
+	pending_y = clamp127(pending_y + scaleToPeriod(Y, &rem_y, dt, g_eeprom_data.cfg.mouse_divisor));
+	pending_w = clamp127(pending_w + wvalue);
 
 	last_read_controller_bytes[0] = btns;
-	last_read_controller_bytes[1] = X & 0xff;
-	last_read_controller_bytes[2] = Y & 0xff;
-	last_read_controller_bytes[3] = wvalue;
+	last_read_controller_bytes[1] = pending_x & 0xff;
+	last_read_controller_bytes[2] = pending_y & 0xff;
+	last_read_controller_bytes[3] = pending_w & 0xff;
 }
 
-static void i2cMouse_Update(void)
+static unsigned char orig_x=0x80, orig_y=0x80;
+static uint16_t last_sample_time;
+
+/* Mouse buttons: 0x01 left, 0x02 right, 0x04 middle.
+ * The d-pad bits (0x10 up, 0x20 down, 0x40 right, 0x80 left)
+ * move the pointer. They land in the report padding. */
+static const struct accessory_button_map nunchuk_map[] PROGMEM = {
+	{ ACC_BTN_Z, 0x01 },
+	{ ACC_BTN_C, 0x02 },
+};
+
+static const struct accessory_button_map classic_map[] PROGMEM = {
+	{ ACC_BTN_B|ACC_BTN_A, 0x01 },
+	{ ACC_BTN_Y|ACC_BTN_X, 0x02 },
+	{ ACC_BTN_START, 0x04 },
+	{ ACC_BTN_UP, 0x10 },
+	{ ACC_BTN_DOWN, 0x20 },
+	{ ACC_BTN_RIGHT, 0x40 },
+	{ ACC_BTN_LEFT, 0x80 },
+};
+
+static char i2cMouse_Poll(void)
 {
-	unsigned char buf[16];
-	char res;
-	unsigned char x=0x80,y=0x80;
-	static unsigned char orig_x=0x80, orig_y=0x80;
+	struct accessory_sample *acc = &g_accessory;
+	unsigned char x = 0x80, y = 0x80;
 	unsigned char btns=0;
-	unsigned short rx=0x200,ry=0x10,rz=0x200;
-	static char device_changed = 0;
-
-	switch (state)
-	{
+	unsigned short rx = 0x200, ry=0x10;
+	uint16_t now, dt;
 
-		case STATE_INIT:
-			// For now, we consider everything answering at this address to be the motion plus.
-			// This switches the mplus to the standard address.
-			res = w2i_reg_writeByte(I2C_W2I_MPLUS_ADDRESS, 0xFE, 0x04);
-			// ignore failure
-
-			//
-			// Init sequence from:
-			//
-			// http://wiibrew.org/wiki/Wiimote/Extension_Controllers
-			//
-			res = w2i_reg_writeByte(I2C_STANDARD_ADDRESS, W2I_REG_UNKNOWN_F0, 0x55);
-			if (res)
-				return;
-
-			res = w2i_reg_writeByte(I2C_STANDARD_ADDRESS, W2I_REG_UNKNOWN_FB, 0x00);
-			if (res)
-				return;
-
-			res = w2i_reg_readBlock(W2I_REG_ID_L, buf, 2);
-			if (res)
-				return;
-
-			peripheral_id = buf[1] | buf[0]<<8;
-
-			state = STATE_READ_DATA;
-			device_changed = 1;
-			_delay_ms(1000);
-			break;
+	if (!accessory_poll())
+		return 0;
 
-			// fallthrough
-		case STATE_READ_DATA:
-			res = w2i_reg_readBlock(W2I_REG_REPORT, buf, 6);
-			if (res) {
-				state = STATE_INIT;
-				return;
-			}
+	now = timer_now();
+	dt = now - last_sample_time;
+	last_sample_time = now;
+	// After a pause (first sample, reconnection), assume the usual rate
+	if (acc->new_device || dt > MOUSE_PERIOD * 2)
+		dt = MOUSE_PERIOD;
 
-			switch (peripheral_id)
-			{
-				default:
-				case ID_NUNCHUK:
-					// Source: http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Nunchuck
-					//
-					//     7   6    5   4    3   2     1   0
-					// 0   SX<7:0>
-					// 1   SY<7:0>
-					// 2   AX<9:2>
-					// 3   AY<9:2>
-					// 4   AZ<9:2>
-					// 5   AZ<1:0>  AY<1:0>  AX<1:0>   BC  BZ
-					//
-					x = buf[0];
-					y = buf[1] ^ 0xff;
-					rx = ((buf[5] & 0x0C) >> 2)	| (buf[2] << 2);
-					ry = 0x10; // ((buf[5] & 0x30) >> 4)	| (buf[3] << 2);
-					rz = ((buf[5] & 0xC0) >> 6)	| (buf[4] << 2);
-
-					if (!(buf[5]&0x01)) btns |= 0x01;
-					if (!(buf[5]&0x02)) btns |= 0x02;
-
-					if (device_changed) {
-						device_changed = 0;
-
-						orig_x = x;
-						orig_y = y;
-					}
-
-					break;
-
-				case ID_CLASSIC:
-					// Source: http://wiibrew.org/wiki/Wiimote/Extension_Controllers/Classic_Controller
-					//
-					//     7        6     5    4    3     2     1     0
-					// 0   RX<4:3>        LX<5:0>
-					// 1   RX<2:1>        LY<5:0>
-					// 2   RX<0>    LT<4:3>    RY<4:0>
-					// 3   LT<2:0>             RT<4:0>
-					// 4   BDR      BDD   BLT  B-   BH    B+    BRT   1
-					// 5   BZL      BB    BY   BA   BX    BZR   BDL   BDU
-					//
-					x = buf[0] << 2;
-					y = (buf[1] << 2) ^ 0xFF;
-					rx = ((buf[2]>>7) | ((buf[1]&0xC0)>>5) | ((buf[0]&0xC0)>>3)) << 5;
-					ry = buf[2]&0x1f;
-					rz = ((buf[3]>>5) | ((buf[2] & 0x60) >> 2) ) << 5;
-					rz ^= 0xffff;
-
-					if (!(buf[4] & 0x04)) btns |= 0x04; // +/Start
-					if (!(buf[5] & 0x20)) btns |= 0x02; // Y
-					if (!(buf[5] & 0x08)) btns |= 0x02; // X
-					if (!(buf[5] & 0x40)) btns |= 0x01; // B
-					if (!(buf[5] & 0x10)) btns |= 0x01; // A
-/*
-					if (!(buf[4] & 0x20)) btns_l |= 0x20; // L trig
-					if (!(buf[4] & 0x02)) btns_l |= 0x40; // R trig
-					if (!(buf[5] & 0x04)) btns_l |= 0x80; // Zr
+	switch (acc->id)
+	{
+		default:
+		case ACCESSORY_NUNCHUK:
+			x = acc->lx;
+			y = acc->ly ^ 0xff;
+			rx = acc->accel[0];
 
-						*/
+			btns = ACCESSORY_MAP_BUTTONS(acc->buttons, nunchuk_map);
+			break;
 
-					if (!(buf[5] & 0x01)) btns |= 0x10; // UP
-					if (!(buf[4] & 0x40)) btns |= 0x20; // DOWN
-					if (!(buf[4] & 0x80)) btns |= 0x40; // RIGHT
-					if (!(buf[5] & 0x02)) btns |= 0x80; // LEFT
-/*
-					if (!(buf[5] & 0x80)) btns_h |= 0x10; // Zl
-					if (!(buf[4] & 0x10)) btns_h |= 0x20; // SELECT
-					if (!(buf[4] & 0x08)) btns_h |= 0x40; // HOME
-*/
-					if (device_changed) {
-						device_changed = 0;
+		case ACCESSORY_CLASSIC:
+			x = acc->lx << 2;
+			y = (acc->ly << 2) ^ 0xFF;
+			ry = acc->ry;
 
-						orig_x = x;
-						orig_y = y;
-					}
-					break;
+			btns = ACCESSORY_MAP_BUTTONS(acc->buttons, classic_map);
+			break;
 
-			} // switch peripheral_id
+		case ACCESSORY_MPLUS:
+			break;
+	}
 
-			break; // STATE
+	if (acc->new_device) {
+		orig_x = x;
+		orig_y = y;
 	}
 
-	setLastValues(x,y,rx,ry,rz,btns,orig_x,orig_y);
-}
+	config_profileChord(i2cGamepad_profileChord(acc));
 
-static void i2cMouse_Init(void)
-{
-	//
-	// TWPS = 0
-	// CPU FREQ = 12000000
-	// TARGET SCL FREQ = 400000
-	//
-	//                   CPU FREQ
-	//             --------------------
-	// SCL freq =  16 + 2*TWBR * 4^TWPS
-	//
-	// TWBR = (((12000000 / 400000) - 16) / 1) / 2 = 7
-	//
-	//i2c_init(I2C_FLAG_EXTERNAL_PULLUP, 15);
-
-	// In fact, 100khz is stable.
-	i2c_init(I2C_FLAG_EXTERNAL_PULLUP, 52);
-
-	i2cMouse_Update();
-
-	DDRC |= 0x01;
-	DEBUGLOW();
+	setLastValues(acc->id, x, y, rx, ry, btns, orig_x, orig_y, dt);
+
+	return 1;
 }
 
 static char i2cMouse_Changed(void)
@@ -536,6 +403,7 @@ static void i2cMouse_BuildReport(unsigned char *reportBuffer)
 	memcpy(last_reported_controller_bytes,
 			last_read_controller_bytes,
 			REPORT_SIZE);
+	pending_x = pending_y = pending_w = 0;
 }
 
 #define USBDESCR_DEVICE         1
@@ -564,8 +432,9 @@ Gamepad i2cMouse_Gamepad = {
 	reportDescriptorSize:	sizeof(mouse_report_descriptor),
 	deviceDescriptor:	mouse_device_descriptor,
 	deviceDescriptorSize:	sizeof(mouse_device_descriptor),
-	init: 			i2cMouse_Init,
-	update: 		i2cMouse_Update,
+	init: 			accessory_init,
+	update: 		accessory_update,
+	poll:			i2cMouse_Poll,
 	changed:		i2cMouse_Changed,
 	buildReport:		i2cMouse_BuildReport
 };
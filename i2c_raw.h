@@ -24,6 +24,7 @@
 #define I2C_RAW_READ_REG7	0x26
 
 #define I2C_RAW_OK			0xF0
+#define I2C_RAW_BUSY		0xFC
 #define I2C_RAW_BAD_PARAM	0xFD
 #define I2C_RAW_TIMEOUT		0xFE
 #define I2C_RAW_ERROR		0xFF
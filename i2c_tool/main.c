@@ -70,6 +70,27 @@ int pingTest(hid_device *hdl)
 	return 0;
 }
 
+/* Fetch the result of the last command. The adapter performs I2C
+ * transfers in the background and answers I2C_RAW_BUSY until done. */
+static int rawi2c_getResult(hid_device *hdl, unsigned char buffer[8])
+{
+	int n, tries = 100;
+
+	do {
+		n = hid_get_feature_report(hdl, buffer, 8);
+		if (n < 0) {
+			fprintf(stderr, "Could not send feature report (%ls)\n", hid_error(hdl));
+			return -1;
+		}
+		if (buffer[1] != I2C_RAW_BUSY)
+			return n;
+		usleep(1000);
+	} while (--tries);
+
+	fprintf(stderr, "adapter busy\n");
+	return -1;
+}
+
 int rawi2c_readReg(hid_device *hdl, unsigned char reg, unsigned char len, unsigned char *dst)
 {
 	unsigned char buffer[8];
@@ -92,9 +113,8 @@ int rawi2c_readReg(hid_device *hdl, unsigned char reg, unsigned char len, unsign
 		return -1;
 	}
 
-	n = hid_get_feature_report(hdl, buffer, 8);
+	n = rawi2c_getResult(hdl, buffer);
 	if (n < 0) {
-		fprintf(stderr, "Could not send feature report (%ls)\n", hid_error(hdl));
 		return -1;
 	}
 //	dumphex("receive", buffer, 8);
@@ -188,9 +208,8 @@ int rawi2c_writeReg(hid_device *hdl, unsigned char reg, unsigned char len, const
 		return -1;
 	}
 
-	n = hid_get_feature_report(hdl, buffer, 8);
+	n = rawi2c_getResult(hdl, buffer);
 	if (n < 0) {
-		fprintf(stderr, "Could not send feature report (%ls)\n", hid_error(hdl));
 		return -1;
 	}
 
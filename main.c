@@ -32,6 +32,9 @@
 #include "gamepad.h"
 #include "eeprom.h"
 #include "config.h"
+#include "timer.h"
+#include "stats.h"
+#include "trace.h"
 #include "wusbmote_requests.h"
 
 #include "i2c_gamepad.h"
@@ -60,7 +63,7 @@ const uchar dataHidReport[] PROGMEM = {
 	0x15, 0x00,			//   LOGICAL_MINIMUM (0)
 	0x26, 0xff, 0x00,	//   LOGICAL_MAXIMUM (255)
 	0x75, 0x08,			//   REPORT_SIZE (8)
-	0x95, 0x05,			//   REPORT_COUNT (5)
+	0x95, CONFIG_REPORT_SIZE,	//   REPORT_COUNT
 	0x09, 0x01,			//   USAGE (Vendor defined)
 	0xB1, 0x00,			//   FEATURE (Data,Ary,Abs)
 	0xc0				// END_COLLECTION
@@ -106,7 +109,7 @@ uchar my_usbDescriptorConfiguration[] = {    /* USB configuration descriptor */
     0x81,       /* IN endpoint number 1 */
     0x03,       /* attrib: Interrupt endpoint */
     8, 0,       /* maximum packet size */
-    USB_CFG_INTR_POLL_INTERVAL, /* in ms */
+    USB_CFG_INTR_POLL_INTERVAL, /* in ms (patched at runtime in low latency mode) */
 
 	/**** Interface 1 *****/
 
@@ -171,15 +174,73 @@ static void hardwareInit(void)
 	TCCR0A = 0; // normal
 	TCCR0B = 5;
 	TCCR2A = (1<<WGM21);
-	TCCR2B =(1<<CS22)|(1<<CS21)|(1<<CS20);
-	OCR2A= 196;  // for 60 hz
 #else
 	/* configure timer 0 for a rate of 12M/(1024 * 256) = 45.78 Hz (~22ms) */
 	TCCR0 = 5;      /* timer 0 prescaler: 1024 */
+#endif
+	/* Timer 2: Controller poll rate. See setPollRate() */
+
+	/* Timer 1: Free running time base */
+	timer_init();
+}
+
+/* Timer 2 prescaler (clock select) values */
+#define T2_CS_64	(1<<CS22)
+#define T2_CS_128	((1<<CS22)|(1<<CS20))
+#define T2_CS_256	((1<<CS22)|(1<<CS21))
+#define T2_CS_1024	((1<<CS22)|(1<<CS21)|(1<<CS20))
+
+/* Compare value for a given prescaler and rate (CTC mode) */
+#define T2_OCR(prescaler, hz)	((F_CPU / (prescaler) + (hz) / 2) / (hz) - 1)
 
-	TCCR2 = (1<<WGM21)|(1<<CS22)|(1<<CS21)|(1<<CS20);
-	OCR2 = 196; // for 60 hz
+#if T2_OCR(1024, 60) > 255 || T2_OCR(64, 1000) > 255
+#error Poll timer settings must be adjusted for this F_CPU
 #endif
+
+/* Timer 2 settings for each CFG_POLL_RATE_* value. The prescaler
+ * is the smallest one for which the compare value fits 8 bits. */
+static const unsigned char poll_rates[][2] PROGMEM = {
+	[CFG_POLL_RATE_60HZ] = { T2_CS_1024, T2_OCR(1024, 60) },
+	[CFG_POLL_RATE_125HZ] = { T2_CS_1024, T2_OCR(1024, 125) },
+	[CFG_POLL_RATE_250HZ] = { T2_CS_256, T2_OCR(256, 250) },
+	[CFG_POLL_RATE_500HZ] = { T2_CS_128, T2_OCR(128, 500) },
+	[CFG_POLL_RATE_1000HZ] = { T2_CS_64, T2_OCR(64, 1000) },
+};
+
+static unsigned char cur_poll_rate = 0xff;
+
+/* Low latency mode, as configured at startup (it changes the
+ * descriptors, so it takes effect only after reconnecting). */
+static char low_latency;
+
+/* A 1ms interval is pointless if the accessory is sampled less
+ * often. The configured rate is kept for when it is disabled. */
+static unsigned char effectivePollRate(void)
+{
+	return low_latency ? CFG_POLL_RATE_1000HZ : g_eeprom_data.cfg.poll_rate;
+}
+
+static void setPollRate(unsigned char rate)
+{
+	unsigned char cs, ocr;
+
+	cur_poll_rate = rate;
+	if (rate >= sizeof(poll_rates)/sizeof(poll_rates[0])) {
+		rate = CFG_POLL_RATE_60HZ;
+	}
+
+	cs = pgm_read_byte(&poll_rates[rate][0]);
+	ocr = pgm_read_byte(&poll_rates[rate][1]);
+
+#if defined(AT168_COMPATIBLE)
+	TCCR2B = cs;
+	OCR2A = ocr;
+#else
+	TCCR2 = (1<<WGM21) | cs;
+	OCR2 = ocr;
+#endif
+	// Start over, in case the counter is already past the new compare value.
+	TCNT2 = 0;
 }
 
 #if defined(AT168_COMPATIBLE)
@@ -190,6 +251,121 @@ static void hardwareInit(void)
 	#define clrPollControllers()	do { TIFR = 1<<OCF2; } while(0)
 #endif
 
+/**** Host poll phase alignment ****
+ *
+ * Sampling on the timer 2 tick drifts against the host's interrupt IN
+ * polls, so a report can wait up to a full period before being sent.
+ *
+ * USB_COUNT_SOF cannot help: INT0 is wired to D+ (it requires D-), and
+ * low speed devices only see keep-alives anyway. Instead, the moment the
+ * host takes a report from endpoint 1 is used as the phase reference.
+ * In sync mode a report is queued after every sample, so every host
+ * poll is observed. The next sample is then started just early enough
+ * to be done before the following poll. When no polls are observed, the
+ * timer 2 tick is used as usual.
+ */
+#define SYNC_MARGIN			TIMER_US(250)
+#define SYNC_MAX_PERIOD		TIMER_MS(20)
+
+static uint16_t sync_take_time;	// last time the host took a report
+static uint16_t sync_period;	// measured host polling period
+static uint16_t sync_lead;		// time needed to read the accessory
+static uint16_t sync_sample_start;
+static char sync_locked, sync_sampled, sync_sampling, sync_was_ready = 1;
+
+/* Returns true when the host took a report since the last call. */
+static char sync_checkHostPoll(void)
+{
+	char ready = usbInterruptIsReady();
+	char taken = ready && !sync_was_ready;
+	uint16_t now, delta;
+
+	if (taken) {
+		now = timer_now();
+		delta = now - sync_take_time;
+
+		/* Twice as long means a poll was missed. Keep the previous
+		 * estimate. Hosts may also poll less often than the endpoint
+		 * interval, so anything shorter is followed. */
+		if (sync_locked && delta < sync_period * 2 - SYNC_MARGIN) {
+			sync_period += ((int16_t)(delta - sync_period)) / 4;
+		}
+
+		sync_take_time = now;
+		sync_locked = 1;
+		sync_sampled = 0;
+	}
+
+	sync_was_ready = ready;
+
+	return taken;
+}
+
+/* Returns true when it is time to start reading the accessory for
+ * the next host poll. */
+static char sync_sampleDue(void)
+{
+	uint16_t elapsed;
+	uint16_t wait = 0;
+
+	if (!sync_locked)
+		return 0;
+
+	elapsed = timer_now() - sync_take_time;
+	if (elapsed > sync_period * 2 + SYNC_MARGIN) {
+		/* Host stopped polling, polls less often than estimated, or
+		 * the report was not ready in time. Start over from the time
+		 * waited, so a slower host is eventually followed. */
+		sync_period = elapsed > SYNC_MAX_PERIOD ? SYNC_MAX_PERIOD : elapsed;
+		sync_locked = 0;
+		sync_sampling = 0;
+		return 0;
+	}
+
+	if (sync_sampled)
+		return 0;
+
+	if (sync_period > sync_lead + SYNC_MARGIN)
+		wait = sync_period - sync_lead - SYNC_MARGIN;
+
+	if (elapsed < wait)
+		return 0;
+
+	sync_sampled = 1;
+	sync_sampling = 1;
+	sync_sample_start = timer_now();
+	return 1;
+}
+
+/* Called when a sample completes. The slowest recent read time is
+ * kept, decaying slowly so a faster bit rate is eventually used. */
+static void sync_sampleDone(void)
+{
+	uint16_t duration = timer_now() - sync_sample_start;
+
+	// Samples started by the timer 2 tick say nothing about the read time.
+	if (!sync_sampling)
+		return;
+	sync_sampling = 0;
+
+	if (duration > sync_lead) {
+		sync_lead = duration;
+	} else {
+		sync_lead -= (sync_lead - duration) / 8;
+	}
+}
+
+/* Restart and enumerate again. hardwareInit() holds the
+ * bus in SE0 state, which the host sees as a disconnect. */
+static void restart(void)
+{
+	eeprom_commit();
+
+	cli();
+	wdt_enable(WDTO_15MS);
+	for (;;) { }
+}
+
 static void usbReset(void)
 {
 	/* [...] a single ended zero or SE0 can be used to signify a device
@@ -246,12 +422,19 @@ uchar	usbFunctionDescriptor(struct usbRequest *rq)
 
 static uchar g_set_report_interface = 0;
 
+/* Feature report of interface 1. Receives commands, then holds
+ * the reply which is read with GET_REPORT. */
+static uchar config_buf[CONFIG_REPORT_SIZE];
+static uchar config_len, config_want;
+
 uchar	usbFunctionSetup(uchar data[8])
 {
 	uchar rqdata[4];
 	static uchar replybuf[8];
 	usbRequest_t    *rq = (void *)data;
 
+	TRACE(TRACE_USB_SETUP, rq->bRequest);
+
 	usbMsgPtr = reportBuffer;
 
 	switch (rq->bmRequestType & USBRQ_TYPE_MASK)
@@ -264,6 +447,10 @@ uchar	usbFunctionSetup(uchar data[8])
 					/* we only have one report type, so don't look at wValue */
 					if (rq->wValue.bytes[1] == 0x03) // Feature report
 					{
+						if (rq->wIndex.word == 1) {
+							usbMsgPtr = config_buf;
+							return sizeof(config_buf);
+						}
 						if (curGamepad->getFeatureReport)
 							return curGamepad->getFeatureReport(reportBuffer);
 						return 0;
@@ -278,6 +465,13 @@ uchar	usbFunctionSetup(uchar data[8])
 					// wIndex : Interface
 					// Note: Report type not checked (we only have feature reports, not out reports)
 					g_set_report_interface = rq->wIndex.word;
+					if (g_set_report_interface == 1) {
+						if (rq->wLength.word > sizeof(config_buf))
+							return 0;
+						memset(config_buf, 0, sizeof(config_buf));
+						config_len = 0;
+						config_want = rq->wLength.word;
+					}
 					return USB_NO_MSG; // usbFunctionWrite will be called
 			}
 			break;
@@ -296,8 +490,6 @@ uchar	usbFunctionSetup(uchar data[8])
 
 uchar usbFunctionWrite(uchar *data, uchar len)
 {
-	unsigned char dst[8];
-
 	if (g_set_report_interface==0)
 	{
 		if (curGamepad->setFeatureReport)
@@ -310,11 +502,18 @@ uchar usbFunctionWrite(uchar *data, uchar len)
 		return 1;
 	}
 	else {
-		if (len != 5) {
+		// Reports longer than 8 bytes come in several chunks
+		if (config_len + len > sizeof(config_buf)) {
 			return 0xff;
 		}
+		memcpy(config_buf + config_len, data, len);
+		config_len += len;
+		if (config_len < config_want) {
+			return 0; // more to come
+		}
 
-		if (!config_handleCommand(data[0], data+1, dst)) {
+		if (!config_handleReport(config_buf, config_len)) {
+			memset(config_buf, 0, sizeof(config_buf));
 			return 0xff;
 		}
 	}
@@ -331,7 +530,9 @@ void transferGamepadReport(void)
 
 	curGamepad->buildReport(reportBuffer);
 
-	for (i=0; i<=curGamepad->report_size; i+=8)
+	/* No zero-length packet after a full last packet: The host knows the
+	 * report size, and waiting for one more poll adds a full interval. */
+	for (i=0; i<curGamepad->report_size; i+=8)
 	{
 		while (!usbInterruptIsReady()) {
 			usbPoll(); wdt_reset();
@@ -339,11 +540,16 @@ void transferGamepadReport(void)
 		usbSetInterrupt(reportBuffer + i, todo > 8 ? 8 : todo);
 		todo -= 8;
 	}
+
+	STATS_INC(reports);
+	TRACE(TRACE_REPORT, curGamepad->report_size);
 }
 
 int main(void)
 {
 	char must_report = 0, first_run = 1;
+	char restart_pending = 0;
+	uint16_t restart_time = 0;
 
 	hardwareInit();
 	eeprom_init();
@@ -367,6 +573,9 @@ int main(void)
 			break;
 	}
 
+	low_latency = g_eeprom_data.cfg.low_latency;
+	setPollRate(effectivePollRate());
+
 	// configure report descriptor according to
 	// the current gamepad
 	rt_usbHidReportDescriptor = curGamepad->reportDescriptor;
@@ -378,6 +587,15 @@ int main(void)
 	my_usbDescriptorConfiguration[25] = rt_usbHidReportDescriptorSize;
 	my_usbDescriptorConfiguration[26] = rt_usbHidReportDescriptorSize >> 8;
 
+	// In low latency mode, ask the host to poll endpoint 1 every frame. The
+	// spec says 10ms minimum for low speed devices, but hosts honor it in practice.
+	// Endpoint 3 (configuration interface) keeps the default interval.
+	if (low_latency) {
+		my_usbDescriptorConfiguration[33] = 1;
+	}
+	sync_period = TIMER_MS(my_usbDescriptorConfiguration[33]);
+	sync_lead = TIMER_MS(1);
+
 	//wdt_enable(WDTO_2S);
 	curGamepad->init();
 
@@ -385,23 +603,67 @@ int main(void)
 	usbInit();
 	sei();
 
+	stats_loopInit();
+
 	for(;;){	/* main event loop */
 		wdt_reset();
 
+		stats_loopIteration();
+
 		// this must be called at each 50 ms or less
+		stats_loopMark(LOOP_TAG_USBPOLL);
 		usbPoll();
+		stats_loopMark(LOOP_TAG_MAIN);
+
+		// Apply poll rate changes received over USB
+		if (effectivePollRate() != cur_poll_rate) {
+			setPollRate(effectivePollRate());
+		}
+
+		// A profile using another mode was selected. Let
+		// the control transfer complete, then restart.
+		if (config_mustRestart()) {
+			if (!restart_pending) {
+				restart_pending = 1;
+				restart_time = timer_now();
+			} else if ((uint16_t)(timer_now() - restart_time) > TIMER_MS(50)) {
+				restart();
+			}
+		}
+
+		stats_loopMark(LOOP_TAG_EEPROM);
+		eeprom_poll();
+
+		stats_loopMark(LOOP_TAG_UPDATE);
 
 		if (first_run) {
 			curGamepad->update();
 			first_run = 0;
 		}
 
-		if (mustPollControllers())
+		if (g_eeprom_data.cfg.sync_host && sync_checkHostPoll()) {
+			/* A report still waiting would now go out at the poll after
+			 * next. The sample started for the next poll replaces it. */
+			must_report = 0;
+		}
+
+		if (sync_sampleDue())
+		{
+			curGamepad->update();
+			if (!curGamepad->poll) {
+				sync_sampleDone();
+				must_report = 1;
+			}
+			clrPollControllers();
+		}
+		else if (mustPollControllers())
 		{
-			if (!must_report)
+			/* Keep sampling while a report waits for the host. The report
+			 * is built from the newest sample when it is sent. */
+			if (!sync_locked)
 			{
 				curGamepad->update();
-				if (curGamepad->changed()) {
+				if (!curGamepad->poll && (curGamepad->changed() || g_eeprom_data.cfg.sync_host)) {
 					must_report = 1;
 				}
 			}
@@ -409,6 +671,32 @@ int main(void)
 			clrPollControllers();
 		}
 
+		stats_loopMark(LOOP_TAG_POLL);
+
+		if (curGamepad->poll && curGamepad->poll())
+		{
+			if (must_report) {
+				// The previous sample did not make it to the host
+				STATS_INC(samples_dropped);
+			}
+			if (curGamepad->changed()) {
+				must_report = 1;
+			}
+			if (g_eeprom_data.cfg.sync_host) {
+				// Always report, so the next host poll can be observed.
+				sync_sampleDone();
+				must_report = 1;
+			}
+		}
+
+		stats_loopMark(LOOP_TAG_REPORT);
+
+		// The host may have taken the report since the check above.
+		// Queueing the next one right away would hide that poll.
+		if (g_eeprom_data.cfg.sync_host && sync_checkHostPoll()) {
+			must_report = 0;
+		}
+
 		if(must_report && usbInterruptIsReady())
 		{
 			transferGamepadReport();
@@ -0,0 +1,131 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#include <string.h>
+#include "stats.h"
+#include "timer.h"
+
+#define LOOP_BUDGET		TIMER_MS(50)
+
+struct stats g_stats;
+static uint32_t loop_hist[LOOP_HIST_BUCKETS];
+
+static uint16_t loop_start;
+static uint16_t seg_start, seg_max;
+static unsigned char seg_tag, seg_max_tag;
+
+static void put32(uint32_t value, unsigned char dst[4])
+{
+	dst[0] = value;
+	dst[1] = value >> 8;
+	dst[2] = value >> 16;
+	dst[3] = value >> 24;
+}
+
+char stats_get(unsigned char index, unsigned char dst[4])
+{
+	uint32_t value;
+	uint8_t sreg;
+
+	if (index >= sizeof(g_stats) / sizeof(uint32_t))
+		return 0;
+
+	sreg = SREG;
+	cli();
+	value = ((uint32_t*)&g_stats)[index];
+	SREG = sreg;
+
+	put32(value, dst);
+
+	return 1;
+}
+
+char stats_getLoopHist(unsigned char bucket, unsigned char dst[4])
+{
+	if (bucket >= LOOP_HIST_BUCKETS)
+		return 0;
+
+	// Only updated from the main loop
+	put32(loop_hist[bucket], dst);
+
+	return 1;
+}
+
+void stats_reset(void)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	memset(&g_stats, 0, sizeof(g_stats));
+	SREG = sreg;
+
+	memset(loop_hist, 0, sizeof(loop_hist));
+}
+
+void stats_loopInit(void)
+{
+	loop_start = seg_start = timer_now();
+	seg_tag = LOOP_TAG_MAIN;
+	seg_max = 0;
+}
+
+unsigned char stats_loopMark(unsigned char tag)
+{
+	uint16_t now = timer_now();
+	uint16_t t = now - seg_start;
+	unsigned char prev = seg_tag;
+
+	if (t >= seg_max) {
+		seg_max = t;
+		seg_max_tag = seg_tag;
+	}
+	seg_start = now;
+	seg_tag = tag;
+
+	return prev;
+}
+
+void stats_loopIteration(void)
+{
+	uint16_t t, v;
+	unsigned char b;
+
+	stats_loopMark(LOOP_TAG_MAIN);
+
+	/* Iterations longer than the timer period (1.4s) are seen
+	 * modulo that period. */
+	t = seg_start - loop_start;
+	loop_start = seg_start;
+
+	for (b=0, v=t; v && b < LOOP_HIST_BUCKETS-1; b++) {
+		v >>= 1;
+	}
+	loop_hist[b]++;
+
+	if (t > LOOP_BUDGET) {
+		g_stats.loops_over_budget++;
+	}
+	if (t > g_stats.max_loop_time) {
+		g_stats.max_loop_time = t;
+		g_stats.max_loop_tag = seg_max_tag;
+	}
+	g_stats.loop_iterations++;
+
+	seg_max = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef _stats_h__
+#define _stats_h__
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "wusbmote_requests.h"
+
+/* Counters readable over USB with RQ_WUSBMOTE_GET_STATS. Fields
+ * are in STATS_* order (see wusbmote_requests.h) */
+struct stats {
+	uint32_t i2c_xfers;
+	uint32_t i2c_nacks;
+	uint32_t i2c_timeouts;
+	uint32_t reconnects;
+	uint32_t reports;
+	uint32_t samples_dropped;
+	uint32_t loop_iterations;
+	uint32_t max_loop_time; // in timer ticks
+	uint32_t max_loop_tag;
+	uint32_t loops_over_budget;
+	uint32_t bus_recoveries;
+};
+
+extern struct stats g_stats;
+
+/* Some counters are also updated from the TWI interrupt */
+#define STATS_INC(field)	do { uint8_t _sreg = SREG; cli(); g_stats.field++; SREG = _sreg; } while(0)
+
+/* Copy a counter to dst (little endian). Returns 0 if index is invalid. */
+char stats_get(unsigned char index, unsigned char dst[4]);
+char stats_getLoopHist(unsigned char bucket, unsigned char dst[4]);
+void stats_reset(void);
+
+/* Main loop timing. stats_loopIteration() is called at the top of the
+ * main loop. stats_loopMark() attributes the time that follows to a
+ * code location (LOOP_TAG_*) and returns the previous one, so nested
+ * code can restore it when done. */
+void stats_loopInit(void);
+void stats_loopIteration(void);
+unsigned char stats_loopMark(unsigned char tag);
+
+#endif // _stats_h__
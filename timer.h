@@ -0,0 +1,35 @@
+#ifndef _timer_h__
+#define _timer_h__
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* Timer 1 runs freely at F_CPU/256 and serves as time base.
+ *
+ * At 12 MHz, a tick is 21.33 us and the counter wraps
+ * after 1.4 seconds. Compute durations with unsigned 16 bit
+ * arithmetic: (uint16_t)(timer_now() - start)
+ */
+#define TIMER_PRESCALER		256
+#define TIMER_HZ			(F_CPU / TIMER_PRESCALER)
+#define TIMER_US(us)		((uint16_t)((TIMER_HZ * (uint32_t)(us)) / 1000000UL))
+#define TIMER_MS(ms)		((uint16_t)((TIMER_HZ * (uint32_t)(ms)) / 1000UL))
+
+#define timer_init()	do { TCCR1A = 0; TCCR1B = (1<<CS12); } while(0)
+
+static inline uint16_t timer_now(void)
+{
+	uint16_t t;
+	uint8_t sreg = SREG;
+
+	/* The 16 bit read uses the shared TEMP register. Keep
+	 * interrupts from getting between the two halves. */
+	cli();
+	t = TCNT1;
+	SREG = sreg;
+
+	return t;
+}
+
+#endif // _timer_h__
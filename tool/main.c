@@ -19,10 +19,13 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <wchar.h>
+#include <pthread.h>
+#include <ctype.h>
 
 #include "version.h"
 #include "wusbmote.h"
@@ -36,8 +39,13 @@ static void printUsage(void)
 	printf("Options:\n");
 	printf("  -h, --help   Print help\n");
 	printf("  -l, --list   List devices\n");
-	printf("  -s serial    Operate on specified device (required unless -f is specified)\n");
+	printf("  -s serial    Operate on specified device (required unless -f or -a is specified)\n");
+	printf("               May be repeated to operate on several devices.\n");
 	printf("  -f, --force  If no serial is specified, use first device detected.\n");
+	printf("  -a, --all    Operate on all devices found\n");
+	printf("\n");
+	printf("  With -a or more than one -s, the configuration commands are applied to all\n");
+	printf("  devices in parallel, verified, and a per-device report is displayed.\n");
 	printf("\n");
 	printf("Configuratin commands:\n");
 	printf("  --set_serial serial                Assign a new device serial number\n");
@@ -51,6 +59,27 @@ static void printUsage(void)
 	printf("  --scroll_nunchuck_step val         Set the scroll step size (Higher = more scrolling). Typ: 5\n");
 	printf("  --scroll_nunchuck_c val            Enable/disable scrolling by move + C. (1 = enable, 0 = disable)\n");
 	printf("  --scroll_nunchuck_c_threshold val  Stick deflection threshold for scrolling. (Typ: 64)\n");
+	printf("  --poll_rate hz                     Accessory sampling rate: 60, 125, 250, 500 or 1000. Typ: 60\n");
+	printf("  --low_latency val                  Report every 1ms and sample at 1000Hz (1 = enable, 0 = disable)\n");
+	printf("                                     Reconnect the adapter for this to take effect.\n");
+	printf("                                     The poll_rate setting applies again when disabled.\n");
+	printf("  --sync_host val                    Read the accessory right before each host poll (1 = enable, 0 = disable)\n");
+	printf("\n");
+	printf("Profiles:\n");
+	printf("  --profile n                        Select profile n (0-%d). Following commands change this profile.\n", CFG_PROFILES-1);
+	printf("                                     (Holding C+Z with the stick down, or - and +,\n");
+	printf("                                     for 2 seconds selects the next profile)\n");
+	printf("  --copy_profile src:dst             Copy profile src to profile dst\n");
+	printf("  --show_config                      Display the configuration\n");
+	printf("  --apply file                       Apply the settings from a configuration file. Only the\n");
+	printf("                                     settings that differ from the device's are written.\n");
+	printf("                                     The mode, mouse and scroll settings belong to profiles.\n");
+	printf("\n");
+	printf("Diagnostics:\n");
+	printf("  --stats                            Display performance counters\n");
+	printf("  --loop_hist                        Display the main loop duration histogram\n");
+	printf("  --reset_stats                      Zero performance counters and histogram\n");
+	printf("  --trace                            Display the event trace (firmware built with WITH_TRACE)\n");
 	printf("\n");
 	printf("Advanced:\n");
 	printf("  --i2c_raw_mode                     Put the device in raw i2c mode (not joystick, not mouse)\n");
@@ -68,11 +97,23 @@ static void printUsage(void)
 #define OPT_SCRL_NUNCHUCK_C			266
 #define OPT_SCRL_NUNCHUCK_C_THRES	267
 #define OPT_I2C_RAW_MODE			268
+#define OPT_POLL_RATE				269
+#define OPT_LOW_LATENCY				270
+#define OPT_SYNC_HOST				271
+#define OPT_STATS					272
+#define OPT_RESET_STATS				273
+#define OPT_LOOP_HIST				274
+#define OPT_TRACE					275
+#define OPT_PROFILE					276
+#define OPT_COPY_PROFILE			277
+#define OPT_SHOW_CONFIG				278
+#define OPT_APPLY					279
 
 struct option longopts[] = {
 	{ "help", 0, NULL, 'h' },
 	{ "list", 0, NULL, 'l' },
 	{ "force", 0, NULL, 'f' },
+	{ "all", 0, NULL, 'a' },
 	{ "set_serial", 1, NULL, OPT_SET_SERIAL },
 	{ "mouse_mode", 0, NULL, OPT_MOUSE_MODE },
 	{ "joystick_mode", 0, NULL, OPT_JOYSTICK_MODE },
@@ -85,9 +126,276 @@ struct option longopts[] = {
 	{ "scroll_nunchuck_c", 1, NULL, OPT_SCRL_NUNCHUCK_C },
 	{ "scroll_nunchuck_c_threshold", 1, NULL, OPT_SCRL_NUNCHUCK_C_THRES },
 	{ "i2c_raw_mode", 0, NULL, OPT_I2C_RAW_MODE },
+	{ "poll_rate", 1, NULL, OPT_POLL_RATE },
+	{ "low_latency", 1, NULL, OPT_LOW_LATENCY },
+	{ "sync_host", 1, NULL, OPT_SYNC_HOST },
+	{ "stats", 0, NULL, OPT_STATS },
+	{ "reset_stats", 0, NULL, OPT_RESET_STATS },
+	{ "loop_hist", 0, NULL, OPT_LOOP_HIST },
+	{ "trace", 0, NULL, OPT_TRACE },
+	{ "profile", 1, NULL, OPT_PROFILE },
+	{ "copy_profile", 1, NULL, OPT_COPY_PROFILE },
+	{ "show_config", 0, NULL, OPT_SHOW_CONFIG },
+	{ "apply", 1, NULL, OPT_APPLY },
 	{ },
 };
 
+// Timer ticks are 256 cycles at 12MHz
+#define TICKS_TO_US(t)	((t) * 256 / 12)
+
+static const char *loop_tags[LOOP_TAG_COUNT] = {
+	[LOOP_TAG_MAIN] = "main loop",
+	[LOOP_TAG_USBPOLL] = "usbPoll",
+	[LOOP_TAG_UPDATE] = "controller update",
+	[LOOP_TAG_POLL] = "controller poll",
+	[LOOP_TAG_REPORT] = "report transfer",
+	[LOOP_TAG_EEPROM] = "eeprom write",
+	[LOOP_TAG_PROBE] = "accessory timing probe",
+};
+
+static int printStats(wusbmote_hdl_t hdl)
+{
+	static const char *names[STATS_COUNT] = {
+		[STATS_I2C_XFERS] = "I2C transactions",
+		[STATS_I2C_NACKS] = "I2C NACKs",
+		[STATS_I2C_TIMEOUTS] = "I2C timeouts",
+		[STATS_RECONNECTS] = "Accessory reconnects",
+		[STATS_REPORTS] = "Reports sent",
+		[STATS_SAMPLES_DROPPED] = "Samples dropped",
+		[STATS_LOOP_ITERATIONS] = "Main loop iterations",
+		[STATS_MAX_LOOP_TIME] = "Longest main loop (us)",
+		[STATS_MAX_LOOP_TAG] = "Longest main loop spent in",
+		[STATS_LOOPS_OVER_BUDGET] = "Main loops over 50ms",
+		[STATS_BUS_RECOVERIES] = "I2C bus recoveries",
+	};
+	unsigned long value;
+	int i;
+
+	for (i=0; i<STATS_COUNT; i++) {
+		if (wusbmote_get_stat(hdl, i, &value))
+			return -1;
+
+		if (i == STATS_MAX_LOOP_TAG) {
+			printf("  %-28s %s\n", names[i], value < LOOP_TAG_COUNT ? loop_tags[value] : "?");
+			continue;
+		}
+		if (i == STATS_MAX_LOOP_TIME) {
+			value = TICKS_TO_US(value);
+		}
+		printf("  %-28s %lu\n", names[i], value);
+	}
+
+	return 0;
+}
+
+/* Settings commands, and the struct eeprom_cfg field they set */
+static const struct {
+	const char *name;
+	unsigned char rq;
+	unsigned char offset;
+} cfg_fields[] = {
+	{ "mode", RQ_WUSBMOTE_SET_MODE, offsetof(struct eeprom_cfg, mode) },
+	{ "mouse_divisor", RQ_WUSBMOTE_SET_DIVISOR, offsetof(struct eeprom_cfg, mouse_divisor) },
+	{ "mouse_deadzone", RQ_WUSBMOTE_SET_DEADZONE, offsetof(struct eeprom_cfg, mouse_deadzone) },
+	{ "scroll_joystick_invert", RQ_WUSBMOTE_SET_SCROLL_JOYSTICK_INVERT, offsetof(struct eeprom_cfg, scroll_joystick_invert) },
+	{ "scroll_nunchuck_invert", RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_INVERT, offsetof(struct eeprom_cfg, scroll_nunchuck_invert) },
+	{ "scroll_nunchuck_threshold", RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_THRESHOLD, offsetof(struct eeprom_cfg, scroll_nunchuck_threshold) },
+	{ "scroll_nunchuck_step", RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_STEP, offsetof(struct eeprom_cfg, scroll_nunchuck_step) },
+	{ "scroll_nunchuck_c", RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C, offsetof(struct eeprom_cfg, scroll_nunchuck_c) },
+	{ "scroll_nunchuck_c_threshold", RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C_THRESHOLD, offsetof(struct eeprom_cfg, scroll_nunchuck_c_threshold) },
+	{ "poll_rate", RQ_WUSBMOTE_SET_POLL_RATE, offsetof(struct eeprom_cfg, poll_rate) },
+	{ "low_latency", RQ_WUSBMOTE_SET_LOW_LATENCY, offsetof(struct eeprom_cfg, low_latency) },
+	{ "sync_host", RQ_WUSBMOTE_SET_SYNC_HOST, offsetof(struct eeprom_cfg, sync_host) },
+};
+
+#define NUM_CFG_FIELDS	(sizeof(cfg_fields) / sizeof(cfg_fields[0]))
+#define PROFILE_FIELDS	9 // mode to scroll_nunchuck_c_threshold
+
+/* Apply a settings command to cfg instead of sending it. Settings of
+ * profile (or of the active profile if -1) are changed. Returns 0 if the
+ * command is not a setting or the device does not have the field. */
+static int applyToConfig(struct eeprom_cfg *cfg, int cfg_size, const unsigned char cmd[5], int profile)
+{
+	int has_profiles = offsetof(struct eeprom_cfg, profiles) + sizeof(cfg->profiles) <= cfg_size;
+	uint8_t *dst;
+	int i;
+
+	if (profile == cfg->profile)
+		profile = -1;
+	if (profile >= 0 && !has_profiles)
+		return 0;
+
+	if (cmd[0] == RQ_WUSBMOTE_SETSERIAL) {
+		memcpy(cfg->serial, cmd + 1, 4);
+		return 1;
+	}
+
+	// Same as the firmware does for the command
+	if (cmd[0] == RQ_WUSBMOTE_SELECT_PROFILE) {
+		if (!has_profiles || cmd[1] >= CFG_PROFILES)
+			return 0;
+		if (cmd[1] != cfg->profile) {
+			memcpy(&cfg->profiles[cfg->profile], &cfg->mode, sizeof(struct cfg_profile));
+			memcpy(&cfg->mode, &cfg->profiles[cmd[1]], sizeof(struct cfg_profile));
+			cfg->profile = cmd[1];
+		}
+		return 1;
+	}
+
+	for (i=0; i<NUM_CFG_FIELDS; i++) {
+		if (cfg_fields[i].rq != cmd[0])
+			continue;
+		if (cfg_fields[i].offset >= cfg_size)
+			return 0;
+
+		if (profile < 0) {
+			dst = (uint8_t*)cfg + cfg_fields[i].offset;
+		} else if (i < PROFILE_FIELDS) {
+			dst = (uint8_t*)&cfg->profiles[profile] + cfg_fields[i].offset - offsetof(struct eeprom_cfg, mode);
+		} else {
+			return 0;
+		}
+		*dst = cmd[1];
+
+		if (cmd[0] == RQ_WUSBMOTE_SET_LOW_LATENCY)
+			*dst = cmd[1] ? 1 : 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Write the configuration, then read it back to verify */
+static int writeConfig(wusbmote_hdl_t hdl, const struct eeprom_cfg *cfg, int cfg_size, FILE *out)
+{
+	struct eeprom_cfg check;
+
+	fprintf(out, "Writing configuration...");
+	if (wusbmote_set_config(hdl, cfg, cfg_size)) {
+		fprintf(out, "failed\n");
+		return -1;
+	}
+
+	memcpy(&check, cfg, sizeof(check));
+	if (wusbmote_get_config(hdl, &check) != cfg_size || memcmp(&check, cfg, sizeof(check))) {
+		fprintf(out, "verification failed\n");
+		return -1;
+	}
+
+	fprintf(out, "verified\n");
+
+	return 0;
+}
+
+static void printConfig(const struct eeprom_cfg *cfg, int cfg_size, FILE *out)
+{
+	int i, p;
+
+	fprintf(out, "  serial: %.4s\n", cfg->serial);
+	for (i=0; i<NUM_CFG_FIELDS; i++) {
+		if (cfg_fields[i].offset < cfg_size) {
+			fprintf(out, "  %s: %d\n", cfg_fields[i].name, ((uint8_t*)cfg)[cfg_fields[i].offset]);
+		}
+	}
+
+	if (offsetof(struct eeprom_cfg, profiles) >= cfg_size)
+		return;
+
+	fprintf(out, "  active profile: %d\n", cfg->profile);
+	for (p=0; p<CFG_PROFILES; p++) {
+		if (p == cfg->profile)
+			continue;
+		fprintf(out, "  profile %d:", p);
+		for (i=0; i<PROFILE_FIELDS; i++) {
+			fprintf(out, " %s=%d", cfg_fields[i].name, ((uint8_t*)&cfg->profiles[p])[i]);
+		}
+		fprintf(out, "\n");
+	}
+}
+
+static void printTraceEvent(unsigned char event, unsigned char arg)
+{
+	switch (event)
+	{
+		case TRACE_I2C_START: printf("I2C start, address 0x%02x\n", arg); break;
+		case TRACE_I2C_STOP: printf("I2C stop\n"); break;
+		case TRACE_I2C_ERROR: printf("I2C error %d\n", arg); break;
+		case TRACE_I2C_TIMEOUT: printf("I2C timeout%s\n", arg ? " (transfer aborted)" : ""); break;
+		case TRACE_UPDATE: printf("Controller update, state %d\n", arg); break;
+		case TRACE_REPORT: printf("Report sent (%d bytes)\n", arg); break;
+		case TRACE_USB_SETUP: printf("USB setup, bRequest 0x%02x\n", arg); break;
+		case TRACE_I2C_RECOVER:
+			if (arg == TRACE_I2C_RECOVER_FAILED)
+				printf("I2C bus recovery failed, SDA still low\n");
+			else
+				printf("I2C bus recovered after %d SCL pulses\n", arg);
+			break;
+		case TRACE_CALIBRATION: printf("Accessory calibration %s\n", arg ? "loaded" : "invalid, using raw values"); break;
+		default: printf("Unknown event %d (0x%02x)\n", event, arg); break;
+	}
+}
+
+static int printTrace(wusbmote_hdl_t hdl)
+{
+	unsigned long size, value;
+	unsigned long time = 0;
+	unsigned short last = 0;
+	int first = 1;
+	int i, retval = 0;
+
+	if (wusbmote_get_trace(hdl, TRACE_GET_SIZE, &size)) {
+		fprintf(stderr, "Trace not available. Firmware built without WITH_TRACE?\n");
+		return -1;
+	}
+
+	for (i=0; i<size; i++) {
+		if (wusbmote_get_trace(hdl, i, &value)) {
+			retval = -1;
+			break;
+		}
+
+		// Entries: 16 bit timer value, event, argument
+		if ((value >> 16 & 0xff) == TRACE_NONE)
+			continue;
+
+		// The timer wraps every 1.4 seconds. Longer gaps go unnoticed.
+		if (!first) {
+			time += (unsigned short)(value - last);
+		}
+		first = 0;
+		last = value;
+
+		printf("  %10lu us  ", TICKS_TO_US(time));
+		printTraceEvent(value >> 16, value >> 24);
+	}
+
+	if (wusbmote_trace_resume(hdl))
+		retval = -1;
+
+	return retval;
+}
+
+static int printLoopHist(wusbmote_hdl_t hdl)
+{
+	unsigned long value;
+	int i;
+
+	for (i=0; i<LOOP_HIST_BUCKETS; i++) {
+		if (wusbmote_get_loop_hist(hdl, i, &value))
+			return -1;
+
+		if (i == 0) {
+			printf("  %7s < %-7lu us: %lu\n", "", TICKS_TO_US(1UL), value);
+		} else if (i == LOOP_HIST_BUCKETS-1) {
+			printf("  %7lu+ %-8s us: %lu\n", TICKS_TO_US(1UL << (i-1)), "", value);
+		} else {
+			printf("  %7lu - %-7lu us: %lu\n", TICKS_TO_US(1UL << (i-1)), TICKS_TO_US(1UL << i), value);
+		}
+	}
+
+	return 0;
+}
+
 static int listDevices(void)
 {
 	int n_found = 0;
@@ -110,18 +418,565 @@ static int listDevices(void)
 	return n_found;
 }
 
+/* A command given on the command line, run on each device */
+struct command {
+	int opt;
+	const char *msg;
+	unsigned char cmd[5];
+	signed char profile; // From a configuration file [profile n] section, or -1
+};
+
+#define MAX_COMMANDS	64
+#define MAX_TARGETS		64
+
+static int parseCommand(int opt, const char *arg, struct command *c)
+{
+	memset(c, 0, sizeof(*c));
+	c->opt = opt;
+	c->profile = -1;
+
+	switch (opt)
+	{
+		case OPT_SET_SERIAL:
+			c->msg = "Setting serial...";
+			if (strlen(arg) != 4) {
+				fprintf(stderr, "Serial number must be 4 characters\n");
+				return -1;
+			}
+			c->cmd[0] = RQ_WUSBMOTE_SETSERIAL;
+			memcpy(c->cmd + 1, arg, 4);
+			break;
+
+		case OPT_MOUSE_MODE:
+		case OPT_JOYSTICK_MODE:
+			c->msg = "Setting mouse/joystick mode...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_MODE;
+			c->cmd[1] = opt == OPT_MOUSE_MODE ? CFG_MODE_MOUSE : CFG_MODE_JOYSTICK;
+			break;
+
+		case OPT_I2C_RAW_MODE:
+			c->msg = "Enabling I2C raw mode\n";
+			c->cmd[0] = RQ_WUSBMOTE_SET_MODE;
+			c->cmd[1] = CFG_MODE_I2C_RAW;
+			break;
+
+		case OPT_MOUSE_DIV:
+			c->msg = "Setting mouse divisor...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_DIVISOR;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_MOUSE_DZ:
+			c->msg = "Setting dead zone...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_DEADZONE;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_SCRL_JOY_INVERT:
+			c->msg = "Setting joystick invert scroll...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_SCROLL_JOYSTICK_INVERT;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_SCRL_NUNCHUCK_INVERT:
+			c->msg = "Setting nunchuck inverted scroll-by-rolling...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_INVERT;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_SCRL_NUNCHUCK_THRES:
+			c->msg = "Setting nunchuck scroll-by-rolling threshold...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_THRESHOLD;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_SCRL_NUNCHUCK_STEP:
+			c->msg = "Setting nunchuck scroll-by-rolling step...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_STEP;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_SCRL_NUNCHUCK_C:
+			c->msg = "Enabling/Disabling nunchuck scroll by C-button...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_SCRL_NUNCHUCK_C_THRES:
+			c->msg = "Setting nunchuck scroll by C-button threshold...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C_THRESHOLD;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_POLL_RATE:
+			c->msg = "Setting poll rate...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_POLL_RATE;
+			switch (strtol(arg, NULL, 0))
+			{
+				case 60: c->cmd[1] = CFG_POLL_RATE_60HZ; break;
+				case 125: c->cmd[1] = CFG_POLL_RATE_125HZ; break;
+				case 250: c->cmd[1] = CFG_POLL_RATE_250HZ; break;
+				case 500: c->cmd[1] = CFG_POLL_RATE_500HZ; break;
+				case 1000: c->cmd[1] = CFG_POLL_RATE_1000HZ; break;
+				default:
+					fprintf(stderr, "Unsupported poll rate. Use 60, 125, 250, 500 or 1000.\n");
+					return -1;
+			}
+			break;
+
+		case OPT_LOW_LATENCY:
+			c->msg = "Enabling/Disabling low latency mode...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_LOW_LATENCY;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_SYNC_HOST:
+			c->msg = "Enabling/Disabling host poll synchronisation...";
+			c->cmd[0] = RQ_WUSBMOTE_SET_SYNC_HOST;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_PROFILE:
+			c->msg = "Selecting profile...";
+			c->cmd[0] = RQ_WUSBMOTE_SELECT_PROFILE;
+			c->cmd[1] = strtol(arg, NULL, 0);
+			break;
+
+		case OPT_COPY_PROFILE:
+			{
+				const char *colon = strchr(arg, ':');
+
+				if (!colon) {
+					fprintf(stderr, "Use --copy_profile src:dst\n");
+					return -1;
+				}
+				c->msg = "Copying profile...";
+				c->cmd[0] = RQ_WUSBMOTE_COPY_PROFILE;
+				c->cmd[1] = strtol(arg, NULL, 0);
+				c->cmd[2] = strtol(colon + 1, NULL, 0);
+			}
+			break;
+
+		case OPT_SHOW_CONFIG:
+			// Displayed once pending settings are written
+			break;
+
+		case OPT_STATS:
+			c->msg = "Performance counters:\n";
+			break;
+
+		case OPT_TRACE:
+			c->msg = "Event trace:\n";
+			break;
+
+		case OPT_LOOP_HIST:
+			c->msg = "Main loop duration histogram:\n";
+			break;
+
+		case OPT_RESET_STATS:
+			c->msg = "Resetting performance counters...";
+			c->cmd[0] = RQ_WUSBMOTE_RESET_STATS;
+			break;
+
+		default:
+			// Not a command
+			return 1;
+	}
+
+	return 0;
+}
+
+static char *trim(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str))
+		str++;
+
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		end--;
+	*end = 0;
+
+	return str;
+}
+
+/* Read a configuration file into commands. Lines are key = value where
+ * keys are the long option names (serial, mode and profile are also
+ * accepted), and [profile n] starts a section for profile n settings:
+ *
+ *   # Office adapters
+ *   mode = mouse
+ *   poll_rate = 125
+ *   profile = 0
+ *
+ *   [profile 1]
+ *   mode = joystick
+ */
+static int loadConfigFile(const char *filename, struct command *cmds, int *n_cmds)
+{
+	FILE *fptr;
+	char line[256];
+	int lineno = 0, profile = -1, retval = 0;
+
+	fptr = fopen(filename, "r");
+	if (!fptr) {
+		perror(filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fptr))
+	{
+		char *key, *value, *eq;
+		int i, opt = 0;
+
+		lineno++;
+
+		key = trim(line);
+		if (*key == 0 || *key == '#')
+			continue;
+
+		if (*key == '[') {
+			if (sscanf(key, "[profile %d]", &profile) != 1 || profile < 0 || profile >= CFG_PROFILES) {
+				fprintf(stderr, "%s:%d: Unknown section %s\n", filename, lineno, key);
+				retval = -1;
+				break;
+			}
+			continue;
+		}
+
+		eq = strchr(key, '=');
+		if (!eq) {
+			fprintf(stderr, "%s:%d: Expected key = value\n", filename, lineno);
+			retval = -1;
+			break;
+		}
+		*eq = 0;
+		key = trim(key);
+		value = trim(eq + 1);
+
+		if (0 == strcmp(key, "mode")) {
+			if (0 == strcmp(value, "mouse")) {
+				opt = OPT_MOUSE_MODE;
+			} else if (0 == strcmp(value, "joystick")) {
+				opt = OPT_JOYSTICK_MODE;
+			} else if (0 == strcmp(value, "i2c_raw")) {
+				opt = OPT_I2C_RAW_MODE;
+			} else {
+				fprintf(stderr, "%s:%d: Mode must be mouse, joystick or i2c_raw\n", filename, lineno);
+				retval = -1;
+				break;
+			}
+		} else if (0 == strcmp(key, "serial")) {
+			opt = OPT_SET_SERIAL;
+		} else {
+			for (i=0; longopts[i].name; i++) {
+				if (longopts[i].has_arg && 0 == strcmp(key, longopts[i].name)) {
+					opt = longopts[i].val;
+					break;
+				}
+			}
+		}
+
+		// Only settings belong in a configuration file
+		switch (opt)
+		{
+			case 0:
+			case OPT_COPY_PROFILE:
+			case OPT_APPLY:
+				fprintf(stderr, "%s:%d: Unknown setting '%s'\n", filename, lineno, key);
+				retval = -1;
+				break;
+
+			case OPT_SET_SERIAL:
+			case OPT_PROFILE:
+			case OPT_POLL_RATE:
+			case OPT_LOW_LATENCY:
+			case OPT_SYNC_HOST:
+				if (profile >= 0) {
+					fprintf(stderr, "%s:%d: '%s' is not a profile setting\n", filename, lineno, key);
+					retval = -1;
+				}
+				break;
+		}
+		if (retval)
+			break;
+
+		if (*n_cmds >= MAX_COMMANDS) {
+			fprintf(stderr, "%s: Too many settings (max %d)\n", filename, MAX_COMMANDS);
+			retval = -1;
+			break;
+		}
+		if (parseCommand(opt, value, &cmds[*n_cmds])) {
+			fprintf(stderr, "%s:%d: Invalid value for '%s'\n", filename, lineno, key);
+			retval = -1;
+			break;
+		}
+		cmds[*n_cmds].profile = profile;
+		(*n_cmds)++;
+	}
+
+	fclose(fptr);
+
+	return retval;
+}
+
+/* Run the commands on a device. cfg receives the resulting configuration
+ * and cfg_size its size (-1 if the firmware cannot report it). */
+static int runCommands(wusbmote_hdl_t hdl, const struct command *cmds, int n_cmds,
+						FILE *out, struct eeprom_cfg *cfg, int *cfg_size)
+{
+	int i, n, retval = 0;
+	int must_commit = 0, cfg_dirty = 0;
+
+	/* Settings are changed in a copy of the configuration, written at
+	 * once when done. Older firmware gets individual commands. */
+	memset(cfg, 0, sizeof(*cfg));
+	*cfg_size = wusbmote_get_config(hdl, cfg);
+
+	for (i=0; i<n_cmds; i++)
+	{
+		const struct command *c = &cmds[i];
+
+		if (c->profile >= 0)
+			fprintf(out, "[profile %d] ", c->profile);
+		if (c->msg)
+			fputs(c->msg, out);
+
+		switch (c->opt)
+		{
+			case OPT_STATS:
+				if (printStats(hdl))
+					retval = 1;
+				break;
+
+			case OPT_TRACE:
+				if (printTrace(hdl))
+					retval = 1;
+				break;
+
+			case OPT_LOOP_HIST:
+				if (printLoopHist(hdl))
+					retval = 1;
+				break;
+		}
+
+		if (c->cmd[0] && *cfg_size > 0) {
+			struct eeprom_cfg before = *cfg;
+
+			if (applyToConfig(cfg, *cfg_size, c->cmd, c->profile)) {
+				// Settings already right are not written again
+				if (memcmp(&before, cfg, sizeof(before))) {
+					fprintf(out, "ok\n");
+					cfg_dirty = 1;
+				} else {
+					fprintf(out, "unchanged\n");
+				}
+				continue;
+			}
+		}
+
+		if (c->profile >= 0) {
+			fprintf(out, "not supported by firmware\n");
+			retval = 1;
+			continue;
+		}
+
+		// Other commands see the settings given before them
+		if ((c->cmd[0] || c->opt == OPT_SHOW_CONFIG) && cfg_dirty) {
+			if (writeConfig(hdl, cfg, *cfg_size, out))
+				retval = 1;
+			cfg_dirty = 0;
+			must_commit = 1;
+		}
+
+		if (c->opt == OPT_SHOW_CONFIG) {
+			if (*cfg_size < 0) {
+				fprintf(stderr, "Configuration read back not supported by firmware\n");
+				retval = 1;
+			} else {
+				fprintf(out, "Configuration:\n");
+				printConfig(cfg, *cfg_size, out);
+			}
+		}
+
+		if (c->cmd[0]) {
+			n = wusbmote_send_cmd(hdl, c->cmd);
+			fprintf(out, "command result: %d\n", n);
+			if (n)
+				retval = 1;
+			if (c->cmd[0] != RQ_WUSBMOTE_RESET_STATS)
+				must_commit = 1;
+
+			// Copying a profile changes the settings
+			if (*cfg_size > 0 && c->cmd[0] == RQ_WUSBMOTE_COPY_PROFILE) {
+				*cfg_size = wusbmote_get_config(hdl, cfg);
+			}
+		}
+	}
+
+	if (cfg_dirty) {
+		if (writeConfig(hdl, cfg, *cfg_size, out))
+			retval = 1;
+		must_commit = 1;
+	}
+
+	// The adapter saves settings on its own after a short while. Don't wait.
+	if (must_commit) {
+		unsigned char cmd[5] = { RQ_WUSBMOTE_COMMIT };
+
+		fprintf(out, "Saving settings...");
+		n = wusbmote_send_cmd(hdl, cmd);
+		fprintf(out, "command result: %d\n", n);
+		if (n)
+			retval = 1;
+	}
+
+	return retval;
+}
+
+/**** Fleet provisioning: the same commands on many devices at once ****/
+
+struct worker {
+	pthread_t thread;
+	struct wusbmote_info info;
+	const struct command *cmds;
+	int n_cmds;
+	wusbmote_hdl_t hdl;
+	FILE *log;
+	struct eeprom_cfg cfg;
+	int cfg_size;
+	const char *status;
+	int failed;
+};
+
+static void *workerThread(void *arg)
+{
+	struct worker *w = arg;
+
+	w->hdl = wusbmote_openDevice(&w->info);
+	if (!w->hdl) {
+		w->status = "FAILED (could not open device)";
+		w->failed = 1;
+		return NULL;
+	}
+
+	if (runCommands(w->hdl, w->cmds, w->n_cmds, w->log, &w->cfg, &w->cfg_size)) {
+		w->status = "FAILED";
+		w->failed = 1;
+	}
+
+	return NULL;
+}
+
+/* Read the configuration back from a device after everything is done */
+static void verifyWorker(struct worker *w)
+{
+	struct eeprom_cfg check;
+
+	if (w->failed)
+		return;
+
+	if (w->cfg_size < 0) {
+		w->status = "ok (not verified, firmware cannot read back configuration)";
+		return;
+	}
+
+	memcpy(&check, &w->cfg, sizeof(check));
+	if (wusbmote_get_config(w->hdl, &check) != w->cfg_size || memcmp(&check, &w->cfg, sizeof(check))) {
+		w->status = "FAILED (verification)";
+		w->failed = 1;
+		return;
+	}
+
+	w->status = "ok (verified)";
+}
+
+static int provision(struct wusbmote_info *devices, int n_devices,
+						const struct command *cmds, int n_cmds)
+{
+	struct worker *workers;
+	int i, c, n_failed = 0;
+
+	workers = calloc(n_devices, sizeof(struct worker));
+	if (!workers) {
+		perror("calloc");
+		return -1;
+	}
+
+	printf("Provisioning %d device(s)...\n", n_devices);
+
+	for (i=0; i<n_devices; i++) {
+		struct worker *w = &workers[i];
+
+		w->info = devices[i];
+		w->cmds = cmds;
+		w->n_cmds = n_cmds;
+		w->log = tmpfile();
+		if (!w->log || pthread_create(&w->thread, NULL, workerThread, w)) {
+			fprintf(stderr, "Could not start worker for '%ls'\n", w->info.str_serial);
+			if (w->log)
+				fclose(w->log);
+			w->log = NULL;
+			w->status = "FAILED (not started)";
+			w->failed = 1;
+		}
+	}
+
+	// Output is kept per device and displayed once done
+	for (i=0; i<n_devices; i++) {
+		struct worker *w = &workers[i];
+
+		if (!w->log)
+			continue;
+
+		pthread_join(w->thread, NULL);
+
+		printf("\n--- Device '%ls' serial '%ls' ---\n", w->info.str_prodname, w->info.str_serial);
+		rewind(w->log);
+		while ((c = fgetc(w->log)) != EOF)
+			putchar(c);
+		fclose(w->log);
+	}
+
+	for (i=0; i<n_devices; i++) {
+		verifyWorker(&workers[i]);
+		if (workers[i].failed)
+			n_failed++;
+		wusbmote_closeDevice(workers[i].hdl);
+	}
+
+	printf("\nProvisioning report:\n");
+	for (i=0; i<n_devices; i++) {
+		printf("  serial '%ls': %s\n", workers[i].info.str_serial, workers[i].status);
+	}
+	printf("%d device(s) ok, %d failed\n", n_devices - n_failed, n_failed);
+
+	free(workers);
+
+	return n_failed;
+}
+
 int main(int argc, char **argv)
 {
 	wusbmote_hdl_t hdl;
 	struct wusbmote_list_ctx *listctx;
 	int opt, retval = 0;
+	struct eeprom_cfg cfg;
+	int cfg_size;
 	struct wusbmote_info inf;
-	struct wusbmote_info *selected_device = NULL;
-	int verbose = 0, use_first = 0, serial_specified = 0;
+	struct wusbmote_info *devices = NULL;
+	int n_devices = 0;
+	int verbose = 0, use_first = 0, use_all = 0;
 	int cmd_list = 0;
+	int i;
 #define TARGET_SERIAL_CHARS 128
-	wchar_t target_serial[TARGET_SERIAL_CHARS];
-	const char *short_optstr = "hls:vf";
+	wchar_t target_serials[MAX_TARGETS][TARGET_SERIAL_CHARS];
+	char target_found[MAX_TARGETS];
+	int n_targets = 0;
+	struct command cmds[MAX_COMMANDS];
+	int n_cmds = 0;
+	const char *short_optstr = "hls:vfa";
 
 	while((opt = getopt_long(argc, argv, short_optstr, longopts, NULL)) != -1) {
 		switch(opt)
@@ -129,17 +984,26 @@ int main(int argc, char **argv)
 			case 's':
 				{
 					mbstate_t ps;
+
+					if (n_targets >= MAX_TARGETS) {
+						fprintf(stderr, "Too many serial numbers (max %d)\n", MAX_TARGETS);
+						return -1;
+					}
 					memset(&ps, 0, sizeof(ps));
-					if (mbsrtowcs(target_serial, (const char **)&optarg, TARGET_SERIAL_CHARS, &ps) < 1) {
+					if (mbsrtowcs(target_serials[n_targets], (const char **)&optarg, TARGET_SERIAL_CHARS, &ps) < 1) {
 						fprintf(stderr, "Invalid serial number specified\n");
 						return -1;
 					}
-					serial_specified = 1;
+					target_found[n_targets] = 0;
+					n_targets++;
 				}
 				break;
 			case 'f':
 				use_first = 1;
 				break;
+			case 'a':
+				use_all = 1;
+				break;
 			case 'v':
 				verbose = 1;
 				break;
@@ -152,6 +1016,19 @@ int main(int argc, char **argv)
 			case '?':
 				fprintf(stderr, "Unrecognized argument. Try -h\n");
 				return -1;
+			case OPT_APPLY:
+				if (loadConfigFile(optarg, cmds, &n_cmds))
+					return -1;
+				break;
+			default:
+				if (n_cmds >= MAX_COMMANDS) {
+					fprintf(stderr, "Too many commands (max %d)\n", MAX_COMMANDS);
+					return -1;
+				}
+				if (parseCommand(opt, optarg, &cmds[n_cmds]) < 0)
+					return -1;
+				n_cmds++;
+				break;
 		}
 	}
 
@@ -162,37 +1039,85 @@ int main(int argc, char **argv)
 		return listDevices();
 	}
 
-	if (!serial_specified && !use_first) {
-		fprintf(stderr, "A serial number or -f must be used. Try -h for more information.\n");
+	if (!n_targets && !use_first && !use_all) {
+		fprintf(stderr, "A serial number, -f or -a must be used. Try -h for more information.\n");
 		return 1;
 	}
 
+	if (use_all || n_targets > 1) {
+		for (i=0; i<n_cmds; i++) {
+			switch (cmds[i].opt)
+			{
+				case OPT_SET_SERIAL:
+					fprintf(stderr, "Serial numbers must be set one device at a time\n");
+					return 1;
+				case OPT_STATS:
+				case OPT_TRACE:
+				case OPT_LOOP_HIST:
+					fprintf(stderr, "Diagnostics are available for one device at a time\n");
+					return 1;
+			}
+		}
+	}
+
 	listctx = wusbmote_allocListCtx();
-	while ((selected_device = wusbmote_listDevices(&inf, listctx)))
+	while (wusbmote_listDevices(&inf, listctx))
 	{
-		if (serial_specified) {
-			if (0 == wcscmp(inf.str_serial, target_serial)) {
-				break;
+		int wanted = use_all;
+
+		for (i=0; i<n_targets; i++) {
+			if (0 == wcscmp(inf.str_serial, target_serials[i])) {
+				target_found[i] = 1;
+				wanted = 1;
 			}
 		}
-		else {
-			// use_first == 1
+		if (!n_targets && use_first) {
 			printf("Will use device '%ls' serial '%ls'\n", inf.str_prodname, inf.str_serial);
-			break;
+			wanted = 1;
+		}
+
+		if (wanted) {
+			struct wusbmote_info *tmp = realloc(devices, (n_devices + 1) * sizeof(struct wusbmote_info));
+			if (!tmp) {
+				perror("realloc");
+				break;
+			}
+			devices = tmp;
+			devices[n_devices++] = inf;
+
+			if (!use_all && n_targets <= 1)
+				break;
 		}
 	}
 	wusbmote_freeListCtx(listctx);
 
-	if (!selected_device) {
-		if (serial_specified) {
+	for (i=0; i<n_targets; i++) {
+		if (!target_found[i]) {
+			fprintf(stderr, "Device '%ls' not found\n", target_serials[i]);
+			retval = 1;
+		}
+	}
+
+	if (!n_devices) {
+		if (n_targets) {
 			fprintf(stderr, "Device not found\n");
 		} else {
 			fprintf(stderr, "No device found\n");
 		}
+		free(devices);
 		return 1;
 	}
 
-	hdl = wusbmote_openDevice(selected_device);
+	if (use_all || n_targets > 1) {
+		if (provision(devices, n_devices, cmds, n_cmds))
+			retval = 1;
+		free(devices);
+		wusbmote_shutdown();
+		return retval;
+	}
+
+	hdl = wusbmote_openDevice(&devices[0]);
+	free(devices);
 	if (!hdl) {
 		printf("Error opening device. (Do you have permissions?)\n");
 		return 1;
@@ -200,91 +1125,7 @@ int main(int argc, char **argv)
 
 	printf("Ready.\n");
 
-	optind = 1;
-	while((opt = getopt_long(argc, argv, short_optstr, longopts, NULL)) != -1)
-	{
-		unsigned char cmd[5] = {0,0,0,0,0};
-		int n;
-
-		switch (opt)
-		{
-			case OPT_SET_SERIAL:
-				printf("Setting serial...");
-				if (strlen(optarg) != 4) {
-					fprintf(stderr, "Serial number must be 4 characters\n");
-					return -1;
-				}
-				cmd[0] = RQ_WUSBMOTE_SETSERIAL;
-				memcpy(cmd + 1, optarg, 4);
-				break;
-
-			case OPT_MOUSE_MODE:
-			case OPT_JOYSTICK_MODE:
-				printf("Setting mouse/joystick mode...");
-				cmd[0] = RQ_WUSBMOTE_SET_MODE;
-				cmd[1] = opt == OPT_MOUSE_MODE ? CFG_MODE_MOUSE : CFG_MODE_JOYSTICK;
-				break;
-
-			case OPT_I2C_RAW_MODE:
-				printf("Enabling I2C raw mode\n");
-				cmd[0] = RQ_WUSBMOTE_SET_MODE;
-				cmd[1] = CFG_MODE_I2C_RAW;
-				break;
-
-			case OPT_MOUSE_DIV:
-				printf("Setting mouse divisor...");
-				cmd[0] = RQ_WUSBMOTE_SET_DIVISOR;
-				cmd[1] = strtol(optarg, NULL, 0);
-				break;
-
-			case OPT_MOUSE_DZ:
-				printf("Setting dead zone...");
-				cmd[0] = RQ_WUSBMOTE_SET_DEADZONE;
-				cmd[1] = strtol(optarg, NULL, 0);
-				break;
-
-			case OPT_SCRL_JOY_INVERT:
-				printf("Setting joystick invert scroll...");
-				cmd[0] = RQ_WUSBMOTE_SET_SCROLL_JOYSTICK_INVERT;
-				cmd[1] = strtol(optarg, NULL, 0);
-				break;
-
-			case OPT_SCRL_NUNCHUCK_INVERT:
-				printf("Setting nunchuck inverted scroll-by-rolling...");
-				cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_INVERT;
-				cmd[1] = strtol(optarg, NULL, 0);
-				break;
-
-			case OPT_SCRL_NUNCHUCK_THRES:
-				printf("Setting nunchuck scroll-by-rolling threshold...");
-				cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_THRESHOLD;
-				cmd[1] = strtol(optarg, NULL, 0);
-				break;
-
-			case OPT_SCRL_NUNCHUCK_STEP:
-				printf("Setting nunchuck scroll-by-rolling step...");
-				cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_STEP;
-				cmd[1] = strtol(optarg, NULL, 0);
-				break;
-
-			case OPT_SCRL_NUNCHUCK_C:
-				printf("Enabling/Disabling nunchuck scroll by C-button...");
-				cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C;
-				cmd[1] = strtol(optarg, NULL, 0);
-				break;
-
-			case OPT_SCRL_NUNCHUCK_C_THRES:
-				printf("Setting nunchuck scroll by C-button threshold...");
-				cmd[0] = RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C_THRESHOLD;
-				cmd[1] = strtol(optarg, NULL, 0);
-				break;
-		}
-
-		if (cmd[0]) {
-			n = wusbmote_send_cmd(hdl, cmd);
-			printf("command result: %d\n", n);
-		}
-	}
+	retval = runCommands(hdl, cmds, n_cmds, stdout, &cfg, &cfg_size);
 
 	wusbmote_closeDevice(hdl);
 	wusbmote_shutdown();
@@ -153,20 +153,146 @@ void wusbmote_closeDevice(wusbmote_hdl_t hdl)
 	}
 }
 
-int wusbmote_send_cmd(wusbmote_hdl_t hdl, const unsigned char cmd[5])
+/* Firmware older than the configuration block requests used
+ * 5 byte reports. Commands fall back to those. */
+#define LEGACY_REPORT_SIZE	5
+
+static int sendReport(wusbmote_hdl_t hdl, const unsigned char data[CONFIG_REPORT_SIZE], int quiet)
+{
+	hid_device *hdev = (hid_device*)hdl;
+	unsigned char buffer[1 + CONFIG_REPORT_SIZE];
+
+	buffer[0] = 0x00; // request ID set to 0 (device has only one)
+	memcpy(buffer + 1, data, CONFIG_REPORT_SIZE);
+
+	if (hid_send_feature_report(hdev, buffer, sizeof(buffer)) >= 0)
+		return 0;
+	if (hid_send_feature_report(hdev, buffer, 1 + LEGACY_REPORT_SIZE) >= 0)
+		return 0;
+
+	if (!quiet)
+		fprintf(stderr, "Could not send feature report (%ls)\n", hid_error(hdev));
+	return -1;
+}
+
+static int getReport(wusbmote_hdl_t hdl, unsigned char data[CONFIG_REPORT_SIZE])
 {
 	hid_device *hdev = (hid_device*)hdl;
-	unsigned char buffer[6];
+	unsigned char buffer[1 + CONFIG_REPORT_SIZE];
 	int n;
 
+	memset(buffer, 0, sizeof(buffer));
 	buffer[0] = 0x00; // request ID set to 0 (device has only one)
-	memcpy(buffer + 1, cmd, 5);
 
-	n = hid_send_feature_report(hdev, buffer, 6);
+	n = hid_get_feature_report(hdev, buffer, sizeof(buffer));
 	if (n < 0) {
-		fprintf(stderr, "Could not send feature report (%ls)\n", hid_error(hdev));
+		buffer[0] = 0x00;
+		n = hid_get_feature_report(hdev, buffer, 1 + LEGACY_REPORT_SIZE);
+	}
+	if (n < 0) {
+		fprintf(stderr, "Could not get feature report (%ls)\n", hid_error(hdev));
 		return -1;
 	}
 
+	memcpy(data, buffer + 1, CONFIG_REPORT_SIZE);
+
+	return 0;
+}
+
+int wusbmote_send_cmd(wusbmote_hdl_t hdl, const unsigned char cmd[5])
+{
+	unsigned char data[CONFIG_REPORT_SIZE] = { };
+
+	memcpy(data, cmd, 5);
+
+	return sendReport(hdl, data, 0);
+}
+
+int wusbmote_get_reply(wusbmote_hdl_t hdl, unsigned char reply[5])
+{
+	unsigned char data[CONFIG_REPORT_SIZE];
+
+	if (getReport(hdl, data))
+		return -1;
+
+	memcpy(reply, data, 5);
+
 	return 0;
 }
+
+int wusbmote_get_config(wusbmote_hdl_t hdl, struct eeprom_cfg *cfg)
+{
+	unsigned char data[CONFIG_REPORT_SIZE] = { RQ_WUSBMOTE_GET_CONFIG };
+	int size;
+
+	// Older firmware rejects the request. Not an error worth reporting.
+	if (sendReport(hdl, data, 1))
+		return -1;
+	if (getReport(hdl, data))
+		return -1;
+	if (data[0] != RQ_WUSBMOTE_GET_CONFIG)
+		return -1;
+
+	// Fields the device does not have are left alone.
+	size = data[1];
+	memcpy(cfg, data + 2, size < sizeof(*cfg) ? size : sizeof(*cfg));
+
+	return size;
+}
+
+int wusbmote_set_config(wusbmote_hdl_t hdl, const struct eeprom_cfg *cfg, int size)
+{
+	unsigned char data[CONFIG_REPORT_SIZE] = { RQ_WUSBMOTE_SET_CONFIG };
+
+	if (size > sizeof(*cfg))
+		size = sizeof(*cfg);
+
+	data[1] = size;
+	memcpy(data + 2, cfg, size);
+
+	if (sendReport(hdl, data, 0))
+		return -1;
+
+	return 0;
+}
+
+static int getValue(wusbmote_hdl_t hdl, unsigned char rq, unsigned char index, unsigned long *value)
+{
+	unsigned char cmd[5] = { rq, index };
+	unsigned char reply[5];
+
+	if (wusbmote_send_cmd(hdl, cmd))
+		return -1;
+	if (wusbmote_get_reply(hdl, reply))
+		return -1;
+	if (reply[0] != rq) {
+		fprintf(stderr, "Unexpected reply. Firmware too old?\n");
+		return -1;
+	}
+
+	*value = reply[1] | reply[2] << 8 | reply[3] << 16 | (unsigned long)reply[4] << 24;
+
+	return 0;
+}
+
+int wusbmote_get_stat(wusbmote_hdl_t hdl, unsigned char index, unsigned long *value)
+{
+	return getValue(hdl, RQ_WUSBMOTE_GET_STATS, index, value);
+}
+
+int wusbmote_get_loop_hist(wusbmote_hdl_t hdl, unsigned char bucket, unsigned long *value)
+{
+	return getValue(hdl, RQ_WUSBMOTE_GET_LOOP_HIST, bucket, value);
+}
+
+int wusbmote_get_trace(wusbmote_hdl_t hdl, unsigned char index, unsigned long *value)
+{
+	return getValue(hdl, RQ_WUSBMOTE_GET_TRACE, index, value);
+}
+
+int wusbmote_trace_resume(wusbmote_hdl_t hdl)
+{
+	unsigned char cmd[5] = { RQ_WUSBMOTE_TRACE_RESUME };
+
+	return wusbmote_send_cmd(hdl, cmd);
+}
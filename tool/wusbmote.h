@@ -2,6 +2,8 @@
 #define _wusbmote_h__
 
 #include <wchar.h>
+#include <stdint.h>
+#include "../config.h"
 
 #define OUR_VENDOR_ID 	0x289b
 #define PRODNAME_MAXCHARS	256
@@ -31,6 +33,22 @@ wusbmote_hdl_t wusbmote_openDevice(struct wusbmote_info *dev);
 void wusbmote_closeDevice(wusbmote_hdl_t hdl);
 
 int wusbmote_send_cmd(wusbmote_hdl_t hdl, const unsigned char cmd[5]);
+/* Get the reply to the last command. reply[0] is the command ID. */
+int wusbmote_get_reply(wusbmote_hdl_t hdl, unsigned char reply[5]);
+/* Read a performance counter (STATS_*) */
+int wusbmote_get_stat(wusbmote_hdl_t hdl, unsigned char index, unsigned long *value);
+/* Read a main loop duration histogram bucket */
+int wusbmote_get_loop_hist(wusbmote_hdl_t hdl, unsigned char bucket, unsigned long *value);
+/* Read a trace entry (or the trace size with TRACE_GET_SIZE). Reading
+ * entry 0 stops recording until wusbmote_trace_resume(). */
+int wusbmote_get_trace(wusbmote_hdl_t hdl, unsigned char index, unsigned long *value);
+int wusbmote_trace_resume(wusbmote_hdl_t hdl);
+
+/* Read the whole configuration. Returns the size of the device's
+ * struct eeprom_cfg (fields beyond are left untouched), or -1 */
+int wusbmote_get_config(wusbmote_hdl_t hdl, struct eeprom_cfg *cfg);
+/* Write the first size bytes of the configuration */
+int wusbmote_set_config(wusbmote_hdl_t hdl, const struct eeprom_cfg *cfg, int size);
 
 
 #endif // _wusbmote_h__
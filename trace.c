@@ -0,0 +1,90 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifdef WITH_TRACE
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "trace.h"
+
+#if (TRACE_SIZE & (TRACE_SIZE-1)) || TRACE_SIZE > 128
+#error TRACE_SIZE must be a power of 2 up to 128
+#endif
+
+struct trace_entry {
+	uint16_t time;
+	unsigned char event;
+	unsigned char arg;
+};
+
+static struct trace_entry ring[TRACE_SIZE];
+static unsigned char head; // next entry to write
+static volatile char frozen;
+
+/* Called from the main loop and from the TWI interrupt */
+void trace_add(unsigned char event, unsigned char arg)
+{
+	struct trace_entry *e;
+	uint8_t sreg = SREG;
+
+	cli();
+	if (!frozen) {
+		e = &ring[head];
+		head = (head + 1) & (TRACE_SIZE-1);
+		e->time = TCNT1;
+		e->event = event;
+		e->arg = arg;
+	}
+	SREG = sreg;
+}
+
+/* Index 0 is the oldest entry. Reading it stops recording, so the
+ * host sees a consistent trace until trace_resume() is called. */
+char trace_get(unsigned char index, unsigned char dst[4])
+{
+	struct trace_entry *e;
+
+	if (index == TRACE_GET_SIZE) {
+		dst[0] = TRACE_SIZE;
+		dst[1] = dst[2] = dst[3] = 0;
+		return 1;
+	}
+
+	if (index >= TRACE_SIZE)
+		return 0;
+
+	if (index == 0)
+		frozen = 1;
+
+	e = &ring[(head + index) & (TRACE_SIZE-1)];
+	dst[0] = e->time;
+	dst[1] = e->time >> 8;
+	dst[2] = e->event;
+	dst[3] = e->arg;
+
+	return 1;
+}
+
+void trace_resume(void)
+{
+	frozen = 0;
+}
+
+#endif // WITH_TRACE
@@ -0,0 +1,47 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#ifndef _trace_h__
+#define _trace_h__
+
+#include "wusbmote_requests.h"
+
+/* Event trace. Build with -DWITH_TRACE to record TRACE() events in a
+ * RAM ring buffer, readable with RQ_WUSBMOTE_GET_TRACE. Otherwise
+ * TRACE() compiles to nothing. */
+
+#ifdef WITH_TRACE
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE	32 // entries, power of 2 up to 128
+#endif
+
+void trace_add(unsigned char event, unsigned char arg);
+char trace_get(unsigned char index, unsigned char dst[4]);
+void trace_resume(void);
+
+#define TRACE(event, arg)	trace_add(event, arg)
+
+#else
+
+#define TRACE(event, arg)	do { } while(0)
+
+#endif
+
+#endif // _trace_h__
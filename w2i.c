@@ -0,0 +1,207 @@
+/* wusbmote: Wiimote accessory to USB Adapter
+ * Copyright (C) 2012-2014 Raphaël Assénat
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The author may be contacted at raph@raphnet.net
+ */
+#include <util/delay.h>
+#include <string.h>
+#include "i2c.h"
+#include "w2i.h"
+#include "stats.h"
+#include "timer.h"
+
+/* Delay between transactions, in units of 10us */
+#define TURNAROUND_SAFE		(W2I_TURNAROUND_SAFE_US / 10)
+
+/* The same in timer ticks, rounded up, plus one tick since the time
+ * a transfer ended may be taken just before the timer increments. */
+#define TURNAROUND_TICKS(t)	((t) ? ((uint32_t)(t) * 10 * TIMER_HZ + 999999) / 1000000 + 1 : 0)
+
+static unsigned char turnaround = TURNAROUND_SAFE;
+static uint16_t turnaround_ticks = TURNAROUND_TICKS(TURNAROUND_SAFE);
+static char combined = 0;
+
+/* Genuine accessories handle 400kHz, but the TWI master is not
+ * reliable there (see I2C_TWBR_MIN). Some third party accessories
+ * and long cables need slower rates. The last entry is the safe rate. */
+static const unsigned char bitrates[] = {
+	I2C_TWBR(333333),
+	I2C_TWBR(300000),
+	I2C_TWBR(200000),
+	I2C_TWBR(100000),
+};
+#define BITRATE_SAFE	(sizeof(bitrates)-1)
+
+/* Index of the fastest bit rate w2i_probeTiming() may use. Lowered
+ * when errors occur, reset when a different accessory is connected. */
+static unsigned char bitrate_max = 0;
+static unsigned char bitrate_cur = BITRATE_SAFE;
+static unsigned char last_id[2];
+
+/* Each error adds ERROR_WEIGHT, each successful read removes 1. Two
+ * errors less than ERROR_WEIGHT reads apart lower the bit rate. */
+#define ERROR_WEIGHT	16
+#define ERROR_LIMIT		(ERROR_WEIGHT*2)
+static unsigned char error_score = 0;
+
+/* Candidate delays tried by w2i_probeTiming(), fastest first. */
+static const unsigned char turnaround_steps[] = { 0, 5, 10, 20 };
+
+static void w2i_setTurnaround(unsigned char t)
+{
+	turnaround = t;
+	turnaround_ticks = TURNAROUND_TICKS(t);
+}
+
+uint16_t w2i_turnaroundTicks(void)
+{
+	return turnaround_ticks;
+}
+
+static void w2i_turnaround(void)
+{
+	unsigned char t;
+
+	for (t = turnaround; t; t--) {
+		_delay_us(10);
+	}
+}
+
+char w2i_reg_writeByte(unsigned char i2c_addr, unsigned char reg_addr, unsigned char value)
+{
+	unsigned char tmpbuf[2];
+	char res;
+
+	tmpbuf[0] = reg_addr;
+	tmpbuf[1] = value;
+
+	res = i2c_transaction(i2c_addr, 2, tmpbuf, 0, NULL, 0);
+	w2i_turnaround();
+
+	return res;
+}
+
+char w2i_reg_readBlock(unsigned char i2c_addr, unsigned char reg_addr, unsigned char *dst, int len)
+{
+	char res;
+
+	if (combined) {
+		return i2c_transaction(i2c_addr, 1, &reg_addr, len, dst, 0);
+	}
+
+	res = i2c_transaction(i2c_addr, 1, &reg_addr, 0, NULL, 0);
+	if (res)
+		return res;
+
+	w2i_turnaround();
+
+	res = i2c_transaction(i2c_addr, 0, NULL, len, dst, 0);
+	if (res)
+		return res;
+
+	w2i_turnaround();
+
+	return 0;
+}
+
+void w2i_resetTiming(void)
+{
+	w2i_setTurnaround(TURNAROUND_SAFE);
+	combined = 0;
+	bitrate_cur = BITRATE_SAFE;
+	i2c_setBitRate(bitrates[BITRATE_SAFE]);
+}
+
+/* Read the ID twice and compare with the expected value */
+static char w2i_checkId(unsigned char i2c_addr, const unsigned char id[2])
+{
+	unsigned char buf[2];
+	char i;
+
+	for (i=0; i<2; i++) {
+		if (w2i_reg_readBlock(i2c_addr, W2I_REG_ID_L, buf, 2))
+			return 0;
+		if (memcmp(buf, id, 2))
+			return 0;
+	}
+
+	return 1;
+}
+
+void w2i_probeTiming(unsigned char i2c_addr, const unsigned char id[2])
+{
+	unsigned char i;
+	unsigned char tag = stats_loopMark(LOOP_TAG_PROBE);
+
+	// A different accessory gets a chance to run at full speed
+	if (memcmp(id, last_id, 2)) {
+		memcpy(last_id, id, 2);
+		bitrate_max = 0;
+		error_score = 0;
+	}
+
+	// Find the highest bit rate that works
+	for (i=bitrate_max; i<BITRATE_SAFE; i++) {
+		i2c_setBitRate(bitrates[i]);
+		if (w2i_checkId(i2c_addr, id))
+			break;
+	}
+	if (i == BITRATE_SAFE) {
+		i2c_setBitRate(bitrates[BITRATE_SAFE]);
+	}
+	bitrate_cur = i;
+
+	// Look for the shortest delay between transactions that works.
+	for (i=0; i<sizeof(turnaround_steps); i++) {
+		w2i_setTurnaround(turnaround_steps[i]);
+		if (w2i_checkId(i2c_addr, id))
+			break;
+	}
+	if (i == sizeof(turnaround_steps)) {
+		w2i_setTurnaround(TURNAROUND_SAFE);
+	}
+
+	// Now try using a repeated start between the register address and the read.
+	combined = 1;
+	if (!w2i_checkId(i2c_addr, id)) {
+		combined = 0;
+	}
+
+	stats_loopMark(tag);
+}
+
+char w2i_combinedRead(void)
+{
+	return combined;
+}
+
+void w2i_transferResult(char res)
+{
+	if (!res) {
+		if (error_score)
+			error_score--;
+		return;
+	}
+
+	error_score += ERROR_WEIGHT;
+	if (error_score >= ERROR_LIMIT) {
+		error_score = 0;
+		if (bitrate_cur < BITRATE_SAFE) {
+			bitrate_max = bitrate_cur + 1;
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef _w2i_h__
+#define _w2i_h__
+
+#include <stdint.h>
+
+/* Register access to Wiimote accessories */
+
+#define W2I_REG_REPORT		0x00
+#define W2I_REG_CALIBRATION	0x20 // 16 bytes
+#define W2I_REG_CALIBRATION2	0x30 // copy of the above
+#define W2I_REG_UNKNOWN_F0	0xF0
+#define W2I_REG_UNKNOWN_FB	0xFB
+#define W2I_REG_ID_L		0xFE
+#define W2I_REG_ID_H		0xFF
+
+/* Delay needed by accessories between transactions (for instance between
+ * the register pointer write and the read). 400us was always used before
+ * and works with everything tested so far. */
+#define W2I_TURNAROUND_SAFE_US	400
+
+char w2i_reg_writeByte(unsigned char i2c_addr, unsigned char reg_addr, unsigned char value);
+char w2i_reg_readBlock(unsigned char i2c_addr, unsigned char reg_addr, unsigned char *dst, int len);
+
+/* Go back to safe timings (100kHz, separate write and read transactions,
+ * 400us between transactions). Call before talking to a newly
+ * connected accessory. */
+void w2i_resetTiming(void);
+
+/* Find the fastest way to read the connected accessory (bit rate,
+ * delays, repeated start). id[] holds the two ID bytes, as read
+ * using the safe timings. */
+void w2i_probeTiming(unsigned char i2c_addr, const unsigned char id[2]);
+
+/* To be called with the result of each report read. When errors
+ * become frequent, the next w2i_probeTiming() will not try the current
+ * bit rate again. */
+void w2i_transferResult(char res);
+
+/* True if the accessory accepts a register address write followed by a
+ * repeated start and the read. */
+char w2i_combinedRead(void);
+
+/* Delay the accessory needs between the end of a transaction and
+ * the start of the next one, as found by w2i_probeTiming(). In
+ * timer ticks (see timer.h). Transfers submitted asynchronously
+ * must wait for it too. */
+uint16_t w2i_turnaroundTicks(void);
+
+#endif // _w2i_h__
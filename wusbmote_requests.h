@@ -5,6 +5,14 @@
 #define CFG_MODE_MOUSE      0x01
 #define CFG_MODE_I2C_RAW    0x02
 
+#define CFG_POLL_RATE_60HZ		0x00
+#define CFG_POLL_RATE_125HZ		0x01
+#define CFG_POLL_RATE_250HZ		0x02
+#define CFG_POLL_RATE_500HZ		0x03
+#define CFG_POLL_RATE_1000HZ	0x04
+
+#define CFG_PROFILES		4
+
 #define RQ_WUSBMOTE_SETSERIAL		0x01
 #define RQ_WUSBMOTE_SET_MODE		0x02
 #define RQ_WUSBMOTE_SET_DIVISOR		0x03
@@ -18,4 +26,93 @@
 #define RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C			0x09
 #define RQ_WUSBMOTE_SET_SCROLL_NUNCHUCK_C_THRESHOLD	0x0A
 
+#define RQ_WUSBMOTE_SET_POLL_RATE	0x0B
+#define RQ_WUSBMOTE_SET_LOW_LATENCY	0x0C
+#define RQ_WUSBMOTE_SET_SYNC_HOST	0x0D
+
+/* Performance counters. rqdata[0] selects the counter. The value
+ * (32 bit, little endian) follows the command in the reply. */
+#define RQ_WUSBMOTE_GET_STATS		0x0E
+#define RQ_WUSBMOTE_RESET_STATS		0x0F
+
+#define STATS_I2C_XFERS			0
+#define STATS_I2C_NACKS			1
+#define STATS_I2C_TIMEOUTS		2
+#define STATS_RECONNECTS		3
+#define STATS_REPORTS			4
+#define STATS_SAMPLES_DROPPED	5
+#define STATS_LOOP_ITERATIONS	6
+#define STATS_MAX_LOOP_TIME		7 // in units of 256 CPU cycles (21.33us)
+#define STATS_MAX_LOOP_TAG		8 // LOOP_TAG_* where the longest loop spent most time
+#define STATS_LOOPS_OVER_BUDGET	9 // iterations over 50ms (usbPoll interval limit)
+#define STATS_BUS_RECOVERIES	10 // attempts at freeing a stuck SDA line
+#define STATS_COUNT				11
+
+/* Main loop duration histogram. rqdata[0] selects the bucket. The
+ * count (32 bit, little endian) follows the command in the reply.
+ *
+ * Bucket 0 counts iterations shorter than one timer tick (21.33us),
+ * bucket n those lasting [2^(n-1), 2^n) ticks. The last bucket also
+ * holds everything longer. */
+#define RQ_WUSBMOTE_GET_LOOP_HIST	0x10
+#define LOOP_HIST_BUCKETS		12
+
+#define LOOP_TAG_MAIN			0
+#define LOOP_TAG_USBPOLL		1
+#define LOOP_TAG_UPDATE			2
+#define LOOP_TAG_POLL			3
+#define LOOP_TAG_REPORT			4
+#define LOOP_TAG_EEPROM			5
+#define LOOP_TAG_PROBE			6
+#define LOOP_TAG_COUNT			7
+
+/* Event trace (firmware built with -DWITH_TRACE). rqdata[0] selects the
+ * entry, 0 being the oldest. Reading entry 0 stops recording until
+ * RQ_WUSBMOTE_TRACE_RESUME. The reply holds the timer 1 value (16 bit,
+ * little endian, 21.33us units), the event and its argument.
+ *
+ * With rqdata[0] = TRACE_GET_SIZE, the reply holds the number of entries. */
+#define RQ_WUSBMOTE_GET_TRACE		0x11
+#define RQ_WUSBMOTE_TRACE_RESUME	0x12
+#define TRACE_GET_SIZE			0xFF
+
+/* Settings are saved to EEPROM after 500ms without changes.
+ * This saves them right away. */
+#define RQ_WUSBMOTE_COMMIT			0x13
+
+/* Profiles. Holding C+Z with the stick down (nunchuk) or - and +
+ * (classic controller) for 2 seconds also selects the next profile. A profile using a
+ * different mode restarts the device. */
+#define RQ_WUSBMOTE_SELECT_PROFILE	0x14 // rqdata[0]: profile
+#define RQ_WUSBMOTE_COPY_PROFILE	0x15 // rqdata[0]: source, rqdata[1]: destination
+
+/* Configuration interface feature report size. Commands only use
+ * the first 5 bytes (command, rqdata[4]), so shorter writes
+ * from older tools are accepted. */
+#define CONFIG_REPORT_SIZE			64
+
+/* Whole configuration (struct eeprom_cfg) transfers. Both requests
+ * and replies are the command, the size of the struct (which
+ * identifies the layout version since fields are only ever appended)
+ * and the struct content.
+ *
+ * A shorter struct from an older version only sets the fields it
+ * contains. Invalid content is rejected as a whole. */
+#define RQ_WUSBMOTE_GET_CONFIG		0x16
+#define RQ_WUSBMOTE_SET_CONFIG		0x17
+
+#define TRACE_NONE				0 // unused entry
+#define TRACE_I2C_START			1 // arg: address
+#define TRACE_I2C_STOP			2
+#define TRACE_I2C_ERROR			3 // arg: status
+#define TRACE_I2C_TIMEOUT		4
+#define TRACE_UPDATE			5 // arg: state
+#define TRACE_REPORT			6 // arg: report size
+#define TRACE_USB_SETUP			7 // arg: bRequest
+#define TRACE_I2C_RECOVER		8 // arg: SCL pulses until SDA was released, or TRACE_I2C_RECOVER_FAILED
+#define TRACE_CALIBRATION		9 // arg: 1 if the factory calibration was valid
+#define TRACE_EVENT_COUNT		10
+
+#define TRACE_I2C_RECOVER_FAILED	10 // TRACE_I2C_RECOVER arg: SDA still low after 9 pulses
+
 #endif